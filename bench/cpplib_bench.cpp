@@ -0,0 +1,608 @@
+// Benchmarks for ProcessUtils: spawn latency, output capture and stdin throughput,
+// and concurrency scaling. Results are written as JSON, progress goes to stderr.
+//
+//   cpplib_bench [--quick] [--filter <substring>] [--out <file>] [--iterations <n>]
+//                [--repetitions <n>] [--bytes <n>] [--rss-mb <n>] [--leaked-fds <n>] [--max-concurrency <n>]
+//
+// The data producing/consuming children are this executable itself (--child-write, --child-read),
+// so the numbers do not depend on the tools installed on the machine.
+
+#include <Rbel12b-cpplib/ProcessUtils/ProcessUtils.hpp>
+#include <Rbel12b-cpplib/ProcessUtils/ProcessReactor.hpp>
+#include <Rbel12b-cpplib/ProcessUtils/SpawnServer.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+
+using namespace cpplib;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        bool quick = false;
+        std::string filter;
+        std::string outPath;
+        int iterations = 200;
+        int repetitions = 3;
+        uint64_t bytes = 1ull << 30;
+        size_t lineLength = 64;
+        size_t rssMb = 1024;
+        size_t leakedFds = 10000;
+        size_t maxConcurrency = 1000;
+        std::string selfPath;
+    };
+
+    struct Result
+    {
+        std::string name;
+        std::string unit;
+        std::vector<double> samples;
+        std::map<std::string, std::string> params;
+        std::string error;
+    };
+
+    double microsecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    }
+
+    double percentile(const std::vector<double> &sorted, double p)
+    {
+        if (sorted.empty())
+            return 0;
+        double rank = p * (sorted.size() - 1);
+        size_t low = static_cast<size_t>(rank);
+        size_t high = std::min(low + 1, sorted.size() - 1);
+        return sorted[low] + (sorted[high] - sorted[low]) * (rank - low);
+    }
+
+    std::string jsonString(const std::string &value)
+    {
+        std::string out = "\"";
+        for (char c : value)
+        {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+                continue;
+            }
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    void writeJson(std::ostream &os, const Options &options, const std::vector<Result> &results)
+    {
+        utsname system{};
+        uname(&system);
+
+        os << "{\n  \"benchmark\": \"cpplib_bench\",\n";
+        os << "  \"system\": {\"os\": " << jsonString(system.sysname) << ", \"release\": " << jsonString(system.release)
+           << ", \"machine\": " << jsonString(system.machine) << ", \"cpus\": " << sysconf(_SC_NPROCESSORS_ONLN) << "},\n";
+        os << "  \"config\": {\"quick\": " << (options.quick ? "true" : "false") << ", \"iterations\": " << options.iterations
+           << ", \"repetitions\": " << options.repetitions << ", \"bytes\": " << options.bytes
+           << ", \"line_length\": " << options.lineLength << ", \"rss_mb\": " << options.rssMb << ", \"leaked_fds\": " << options.leakedFds
+           << ", \"max_concurrency\": " << options.maxConcurrency << "},\n";
+        os << "  \"results\": [";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result &result = results[i];
+            std::vector<double> sorted = result.samples;
+            std::sort(sorted.begin(), sorted.end());
+            double mean = sorted.empty() ? 0 : std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+
+            os << (i ? ",\n" : "\n") << "    {\"name\": " << jsonString(result.name) << ", \"unit\": " << jsonString(result.unit)
+               << ", \"samples\": " << sorted.size();
+            if (!sorted.empty())
+            {
+                os << ", \"min\": " << sorted.front() << ", \"median\": " << percentile(sorted, 0.5)
+                   << ", \"mean\": " << mean << ", \"p90\": " << percentile(sorted, 0.9)
+                   << ", \"p99\": " << percentile(sorted, 0.99) << ", \"max\": " << sorted.back();
+            }
+            os << ", \"params\": {";
+            bool first = true;
+            for (const auto &param : result.params)
+            {
+                os << (first ? "" : ", ") << jsonString(param.first) << ": " << jsonString(param.second);
+                first = false;
+            }
+            os << "}";
+            if (!result.error.empty())
+                os << ", \"error\": " << jsonString(result.error);
+            os << "}";
+        }
+        os << "\n  ]\n}\n";
+    }
+
+    // Child side ----------------------------------------------------------------------------
+
+    bool writeAll(int fd, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t written = ::write(fd, data, size);
+            if (written == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    /** Writes bytes of lineLength-long lines to stdout. */
+    int childWrite(uint64_t bytes, size_t lineLength)
+    {
+        std::string block;
+        while (block.size() < 64 * 1024)
+            block += std::string(lineLength - 1, 'x') + '\n';
+        block.resize(64 * 1024 / lineLength * lineLength);
+
+        while (bytes > 0)
+        {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(bytes, block.size()));
+            if (!writeAll(STDOUT_FILENO, block.data(), n))
+                return 1;
+            bytes -= n;
+        }
+        return 0;
+    }
+
+    /** Reads stdin until EOF. */
+    int childRead()
+    {
+        std::vector<char> buffer(256 * 1024);
+        while (true)
+        {
+            ssize_t got = ::read(STDIN_FILENO, buffer.data(), buffer.size());
+            if (got == 0)
+                return 0;
+            if (got == -1 && errno != EINTR)
+                return 1;
+        }
+    }
+
+    // Benchmarks ----------------------------------------------------------------------------
+
+    class Runner
+    {
+    public:
+        explicit Runner(const Options &options) : m_options(options) {}
+
+        bool selected(const std::string &name) const
+        {
+            return m_options.filter.empty() || name.find(m_options.filter) != std::string::npos;
+        }
+
+        void add(Result result)
+        {
+            std::sort(result.samples.begin(), result.samples.end());
+            std::cerr << result.name << ": median " << percentile(result.samples, 0.5) << " " << result.unit;
+            if (!result.error.empty())
+                std::cerr << " (error: " << result.error << ")";
+            std::cerr << std::endl;
+            m_results.push_back(std::move(result));
+        }
+
+        const std::vector<Result> &results() const
+        {
+            return m_results;
+        }
+
+    private:
+        const Options &m_options;
+        std::vector<Result> m_results;
+    };
+
+    struct Backend
+    {
+        const char *name;
+        SpawnBackend backend;
+    };
+
+    std::vector<Backend> spawnBackends()
+    {
+        std::vector<Backend> backends = {
+            {"fork", SpawnBackend::Fork},
+            {"vfork", SpawnBackend::Vfork},
+            {"posix_spawn", SpawnBackend::PosixSpawn},
+        };
+        if (SpawnServer::running())
+            backends.push_back({"server", SpawnBackend::Server});
+        return backends;
+    }
+
+    /**
+     * Spawn + exit latency of /bin/true with no pipes, in microseconds per process.
+     * closeOtherFds: the child closes every fd but 0-2 before exec, see Process::setCloseOtherFds().
+     */
+    void benchSpawn(Runner &runner, const Options &options, const std::string &suffix, bool closeOtherFds = false)
+    {
+        for (const Backend &backend : spawnBackends())
+        {
+            std::string name = "spawn_true/" + std::string(backend.name) + suffix;
+            if (!runner.selected(name))
+                continue;
+
+            Result result{name, "us", {}, {}, {}};
+            result.params["command"] = "/bin/true";
+            result.params["close_other_fds"] = closeOtherFds ? "true" : "false";
+            try
+            {
+                for (int i = 0; i < options.iterations + options.iterations / 10; ++i)
+                {
+                    Process proc;
+                    proc.setCommand(std::filesystem::path("/bin/true"));
+                    proc.setSpawnBackend(backend.backend);
+                    proc.setStdinRedirect(StreamRedirect::null());
+                    proc.setStdoutRedirect(StreamRedirect::null());
+                    proc.setStderrRedirect(StreamRedirect::null());
+                    proc.setCloseOtherFds(closeOtherFds);
+
+                    Clock::time_point start = Clock::now();
+                    proc.start();
+                    proc.waitForExit();
+                    double elapsed = microsecondsSince(start);
+                    if (i >= options.iterations / 10) // the first tenth warms up
+                        result.samples.push_back(elapsed);
+                }
+            }
+            catch (const std::exception &e)
+            {
+                result.error = e.what();
+            }
+            runner.add(std::move(result));
+        }
+    }
+
+    enum class CaptureMode
+    {
+        Lines,
+        Chunks,
+        ChunksReactor,
+        Communicate,
+        SpliceToFile,
+    };
+
+    /** Output capture throughput, in MB/s. */
+    void benchCapture(Runner &runner, const Options &options, const char *modeName, CaptureMode mode)
+    {
+        std::string name = std::string("capture/") + modeName;
+        if (!runner.selected(name))
+            return;
+
+        Result result{name, "MB/s", {}, {}, {}};
+        result.params["bytes"] = std::to_string(options.bytes);
+        result.params["line_length"] = std::to_string(options.lineLength);
+        std::unique_ptr<ProcessReactor> reactor;
+        if (mode == CaptureMode::ChunksReactor)
+            reactor = std::make_unique<ProcessReactor>(1);
+
+        try
+        {
+            for (int rep = 0; rep < options.repetitions; ++rep)
+            {
+                Process proc;
+                proc.setCommand(std::filesystem::path(options.selfPath));
+                proc.appendArguments({"--child-write", std::to_string(options.bytes), std::to_string(options.lineLength)});
+                proc.setStdinRedirect(StreamRedirect::null());
+                proc.setReactor(reactor.get());
+
+                uint64_t received = 0;
+                if (mode == CaptureMode::Lines)
+                    proc.setOutputCallback([&](const std::string &line)
+                                           { received += line.size(); });
+                else
+                    proc.setOutputChunkCallback([&](std::string_view chunk)
+                                                { received += chunk.size(); });
+                if (mode == CaptureMode::SpliceToFile)
+                    proc.setStdoutRedirect(StreamRedirect::captureToFile("/dev/null"));
+
+                Clock::time_point start = Clock::now();
+                if (mode == CaptureMode::Communicate)
+                {
+                    CommunicateOptions communicateOptions;
+                    communicateOptions.maxOutputSize = 0; // measure the transfer, not the string growth
+                    proc.communicate({}, communicateOptions);
+                }
+                else
+                {
+                    proc.run();
+                }
+                double seconds = microsecondsSince(start) / 1e6;
+
+                if (mode == CaptureMode::Communicate || mode == CaptureMode::SpliceToFile)
+                    received = proc.stats().stdoutBytes;
+                if (received != options.bytes)
+                    result.error = "received " + std::to_string(received) + " bytes";
+                result.samples.push_back(options.bytes / 1e6 / seconds);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            result.error = e.what();
+        }
+        runner.add(std::move(result));
+    }
+
+    /**
+     * Throughput of writes to the child's stdin, in MB/s.
+     * pipeSize > 0 also enlarges the pipe and the stream buffer to that size.
+     */
+    void benchStdin(Runner &runner, const Options &options, bool communicate, size_t pipeSize = 0)
+    {
+        std::string name = communicate ? "stdin/communicate" : "stdin/stream";
+        if (pipeSize > 0)
+            name += "/pipe_" + std::to_string(pipeSize >> 10) + "k";
+        if (!runner.selected(name))
+            return;
+
+        // communicate() takes the whole input at once, keep its buffer reasonable.
+        uint64_t bytes = communicate ? std::min<uint64_t>(options.bytes, 256ull << 20) : options.bytes;
+        Result result{name, "MB/s", {}, {}, {}};
+        result.params["bytes"] = std::to_string(bytes);
+        result.params["pipe_size"] = std::to_string(pipeSize);
+        std::string block(communicate ? bytes : 64 * 1024, 'x');
+
+        try
+        {
+            for (int rep = 0; rep < options.repetitions; ++rep)
+            {
+                Process proc;
+                proc.setCommand(std::filesystem::path(options.selfPath));
+                proc.appendArgument("--child-read");
+                proc.setStdinRedirect(StreamRedirect::pipe(pipeSize, pipeSize));
+                proc.setStdoutRedirect(StreamRedirect::null());
+
+                Clock::time_point start = Clock::now();
+                if (communicate)
+                {
+                    proc.communicate(block);
+                }
+                else
+                {
+                    proc.start();
+                    for (uint64_t left = bytes; left > 0;)
+                    {
+                        size_t n = static_cast<size_t>(std::min<uint64_t>(left, block.size()));
+                        proc.in.write(block.data(), n);
+                        left -= n;
+                    }
+                    proc.waitForExit();
+                }
+                double seconds = microsecondsSince(start) / 1e6;
+
+                if (proc.stats().stdinBytes != bytes)
+                    result.error = "wrote " + std::to_string(proc.stats().stdinBytes) + " bytes";
+                result.samples.push_back(bytes / 1e6 / seconds);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            result.error = e.what();
+        }
+        runner.add(std::move(result));
+    }
+
+    /** Wall time to start `count` concurrent /bin/true children and wait for all of them, in milliseconds. */
+    void benchConcurrency(Runner &runner, const Options &options, size_t count, bool useReactor)
+    {
+        std::string name = std::string("concurrency/") + (useReactor ? "reactor/" : "threads/") + std::to_string(count);
+        if (!runner.selected(name))
+            return;
+
+        Result result{name, "ms", {}, {}, {}};
+        result.params["children"] = std::to_string(count);
+        std::unique_ptr<ProcessReactor> reactor;
+        if (useReactor)
+            reactor = std::make_unique<ProcessReactor>(1);
+
+        try
+        {
+            for (int rep = 0; rep < options.repetitions; ++rep)
+            {
+                std::vector<std::unique_ptr<Process>> procs;
+                Clock::time_point start = Clock::now();
+                for (size_t i = 0; i < count; ++i)
+                {
+                    procs.push_back(std::make_unique<Process>());
+                    Process &proc = *procs.back();
+                    proc.setCommand(std::filesystem::path("/bin/true"));
+                    proc.setReactor(reactor.get());
+                    proc.setOutputChunkCallback([](std::string_view) {});
+                    proc.setErrorChunkCallback([](std::string_view) {});
+                    proc.start();
+                }
+                for (auto &proc : procs)
+                    proc->waitForExit();
+                result.samples.push_back(microsecondsSince(start) / 1000);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            result.error = e.what();
+        }
+        runner.add(std::move(result));
+    }
+
+    /** Every child holds a few fds in this process, 1000 of them exceed the usual soft limit. */
+    void raiseFileLimit()
+    {
+        rlimit limit{};
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+        {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+
+    std::string selfPath(const char *argv0)
+    {
+        char path[4096];
+        ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        if (length > 0)
+            return std::string(path, length);
+        return std::filesystem::absolute(argv0).string();
+    }
+
+    bool parseOptions(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string
+            {
+                if (i + 1 >= argc)
+                    throw std::invalid_argument(arg + " needs a value");
+                return argv[++i];
+            };
+
+            if (arg == "--quick")
+                options.quick = true;
+            else if (arg == "--filter")
+                options.filter = value();
+            else if (arg == "--out")
+                options.outPath = value();
+            else if (arg == "--iterations")
+                options.iterations = std::stoi(value());
+            else if (arg == "--repetitions")
+                options.repetitions = std::stoi(value());
+            else if (arg == "--bytes")
+                options.bytes = std::stoull(value());
+            else if (arg == "--rss-mb")
+                options.rssMb = std::stoull(value());
+            else if (arg == "--leaked-fds")
+                options.leakedFds = std::stoull(value());
+            else if (arg == "--max-concurrency")
+                options.maxConcurrency = std::stoull(value());
+            else
+            {
+                std::cerr << "unknown option " << arg << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 4 && std::strcmp(argv[1], "--child-write") == 0)
+        return childWrite(std::stoull(argv[2]), std::stoull(argv[3]));
+    if (argc >= 2 && std::strcmp(argv[1], "--child-read") == 0)
+        return childRead();
+
+    // Forked while this process is still small, like an application would.
+    try
+    {
+        SpawnServer::start();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "spawn server unavailable: " << e.what() << std::endl;
+    }
+
+    Options options;
+    if (argc >= 2 && std::strcmp(argv[1], "--quick") == 0)
+    {
+        options.iterations = 50;
+        options.repetitions = 1;
+        options.bytes = 64ull << 20;
+        options.rssMb = 256;
+        options.leakedFds = 1000;
+        options.maxConcurrency = 100;
+    }
+    try
+    {
+        if (!parseOptions(argc, argv, options))
+            return 2;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 2;
+    }
+    options.selfPath = selfPath(argv[0]);
+    raiseFileLimit();
+
+    Runner runner(options);
+
+    benchSpawn(runner, options, "");
+    {
+        // Touched so the pages are really mapped, that is what fork() has to copy.
+        size_t size = options.rssMb << 20;
+        std::unique_ptr<char[]> ballast(new char[size]);
+        std::memset(ballast.get(), 1, size);
+        benchSpawn(runner, options, "/rss_" + std::to_string(options.rssMb) + "mb");
+    }
+    {
+        // Fds a host leaks without close-on-exec, each one is inherited by every child.
+        std::vector<int> leaked;
+        for (size_t i = 0; i < options.leakedFds; ++i)
+        {
+            int fd = open("/dev/null", O_RDONLY);
+            if (fd == -1)
+                break;
+            leaked.push_back(fd);
+        }
+        std::string suffix = "/leaked_" + std::to_string(leaked.size()) + "fds";
+        benchSpawn(runner, options, suffix);
+        benchSpawn(runner, options, suffix + "_closed", true);
+        for (int fd : leaked)
+            close(fd);
+    }
+
+    benchCapture(runner, options, "lines", CaptureMode::Lines);
+    benchCapture(runner, options, "chunks", CaptureMode::Chunks);
+    benchCapture(runner, options, "chunks_reactor", CaptureMode::ChunksReactor);
+    benchCapture(runner, options, "communicate", CaptureMode::Communicate);
+    benchCapture(runner, options, "splice_to_file", CaptureMode::SpliceToFile);
+
+    benchStdin(runner, options, false);
+    benchStdin(runner, options, true);
+    benchStdin(runner, options, false, 1 << 20);
+    benchStdin(runner, options, true, 1 << 20);
+
+    for (size_t count = 1; count <= options.maxConcurrency; count *= 10)
+    {
+        benchConcurrency(runner, options, count, true);
+        benchConcurrency(runner, options, count, false);
+    }
+
+    if (options.outPath.empty())
+    {
+        writeJson(std::cout, options, runner.results());
+    }
+    else
+    {
+        std::ofstream out(options.outPath);
+        writeJson(out, options, runner.results());
+    }
+
+    SpawnServer::stop();
+    return 0;
+}
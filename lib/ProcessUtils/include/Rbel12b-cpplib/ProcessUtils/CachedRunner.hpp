@@ -0,0 +1,109 @@
+#pragma once
+#include "ProcessUtils.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace cpplib
+{
+    /**
+     * Runs deterministic commands through Process::communicate() and keeps their results in a directory,
+     * so that a later run of the same command replays the stored stdout, stderr and exit code without
+     * spawning anything.
+     *
+     * An entry is keyed by a SHA-256 of the executable (its resolved path, size and modification time, or its
+     * content), the argv, the working directory, the stdin bytes and the environment variables named with
+     * setKeyEnvironment(). Everything else the command depends on, such as the files it reads, is up to the
+     * caller: put it in the arguments or the key environment, or don't cache the command.
+     *
+     * The directory may be shared by several threads and processes: entries are written to a temporary file
+     * and renamed into place, and a reader either sees a complete entry or none. Entries are evicted least
+     * recently used first (by modification time, which a hit refreshes) once the directory holds more than
+     * maxBytes; each runner checks that after it stored about a sixteenth of maxBytes.
+     *
+     * @code
+     * cpplib::CachedRunner cache(".cache/tool-runs", 256 << 20);
+     * cpplib::Process proc;
+     * proc.setCommand(std::filesystem::path("protoc"));
+     * proc.appendArguments({"--version"});
+     * bool hit;
+     * cpplib::CommunicateResult result = cache.run(proc, {}, &hit);
+     * @endcode
+     */
+    class CachedRunner
+    {
+    public:
+        /**
+         * @param directory Where the entries are kept, created if missing.
+         * @param maxBytes Size of the entries kept, larger results are not stored at all.
+         */
+        explicit CachedRunner(const std::filesystem::path &directory, uint64_t maxBytes = uint64_t(1) << 30);
+
+        CachedRunner(const CachedRunner &) = delete;
+        CachedRunner &operator=(const CachedRunner &) = delete;
+
+        /**
+         * Names of the environment variables that are part of the key, with the values the child would get.
+         * None by default; PATH only matters through the executable it resolves to, which is always hashed.
+         */
+        void setKeyEnvironment(std::vector<std::string> names);
+
+        /**
+         * Hashes the executable's content instead of its size and modification time, so that a rebuilt but
+         * identical tool still hits. Each file is read once per size and modification time.
+         */
+        void setHashExecutableContent(bool hashContent);
+
+        /** Also stores runs with a non-zero exit code, off by default so that failures are retried. */
+        void setCacheFailures(bool cacheFailures);
+
+        /**
+         * Runs proc like proc.communicate(input), unless the store has a result for the same key.
+         * stdout and stderr must be pipes and stdin a pipe or /dev/null; mapped fds and shared rings are
+         * rejected. A command whose executable is not found bypasses the cache.
+         * @param cacheHit Set to whether the result was replayed from the store.
+         * @return The exit code and captured output (exceptions are thrown on errors).
+         */
+        CommunicateResult run(Process &proc, std::string_view input = {}, bool *cacheHit = nullptr);
+
+        /** The key run() uses for proc and input as 64 hex digits, empty if the executable is not found. */
+        std::string key(const Process &proc, std::string_view input);
+
+        /** Evicts the least recently used entries until the store holds at most maxBytes. */
+        void trim();
+
+        const std::filesystem::path &directory() const
+        {
+            return m_directory;
+        }
+
+    private:
+        struct ExecutableDigest
+        {
+            uint64_t size;
+            int64_t modified;
+            std::string digest;
+        };
+
+        std::string executableIdentity(const std::filesystem::path &exe);
+        std::filesystem::path entryPath(const std::string &key) const;
+        bool load(const std::filesystem::path &path, CommunicateResult &result);
+        void store(const std::filesystem::path &path, const CommunicateResult &result);
+
+        std::filesystem::path m_directory;
+        uint64_t m_maxBytes;
+        std::vector<std::string> m_keyEnvironment;
+        bool m_hashExecutableContent = false;
+        bool m_cacheFailures = false;
+
+        std::mutex m_mutex;
+        std::unordered_map<std::string, ExecutableDigest> m_executableDigests; // by path
+        uint64_t m_storedSinceTrim = 0;
+        std::string m_tempPrefix; // unique to this runner, for the temporary files
+        uint64_t m_tempCounter = 0;
+    };
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+namespace cpplib
+{
+    /**
+     * Keeps the last bytes of a stream in a fixed-size ring buffer, optionally limited to the last lines too,
+     * see Process::setOutputTail() and setErrorTail(). All memory is allocated by reset(), appending
+     * never allocates, so a process can write any amount of output while the tail stays bounded.
+     */
+    class OutputTail
+    {
+    public:
+        /**
+         * Clears the tail and sets its limits.
+         * @param maxBytes Bytes kept at most, 0 disables the tail.
+         * @param maxLines Lines kept at most (an unterminated last line counts as one), 0 for no line limit.
+         */
+        void reset(size_t maxBytes, size_t maxLines = 0);
+
+        void append(std::string_view chunk);
+
+        /**
+         * The kept output as at most two views into the ring buffer, oldest part first.
+         * Valid until the next append() or reset().
+         */
+        std::pair<std::string_view, std::string_view> segments() const;
+
+        /** The kept output as one string. */
+        std::string str() const;
+
+        size_t size() const;
+
+        bool empty() const
+        {
+            return size() == 0;
+        }
+
+        /** True if earlier output was dropped to respect the limits. */
+        bool truncated() const
+        {
+            return m_total > size();
+        }
+
+        /** Bytes appended since reset(), kept or not. */
+        uint64_t totalBytes() const
+        {
+            return m_total;
+        }
+
+        size_t maxBytes() const
+        {
+            return m_data.size();
+        }
+
+        size_t maxLines() const
+        {
+            return m_maxLines;
+        }
+
+    private:
+        uint64_t start() const;
+
+        std::vector<char> m_data;
+        uint64_t m_total = 0; // also the stream offset of the next byte, stored at m_total % m_data.size()
+        size_t m_maxLines = 0;
+        // Stream offsets just past the last m_maxLines + 1 newlines, a ring indexed by m_newlines % size.
+        std::vector<uint64_t> m_lineEnds;
+        uint64_t m_newlines = 0;
+    };
+};
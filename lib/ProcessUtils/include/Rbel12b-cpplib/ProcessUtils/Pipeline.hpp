@@ -0,0 +1,89 @@
+#pragma once
+#include "ProcessUtils.hpp"
+#include <memory>
+
+namespace cpplib
+{
+    /**
+     * A chain of processes (like `gen | filter | compress` in a shell) where the stdout of
+     * each stage is connected to the stdin of the next one by a kernel pipe, so the data
+     * between stages never passes through this process (POSIX only).
+     *
+     * Each stage is a regular Process: set its environment, working directory and error callback
+     * through the reference returned by addStage(). The first stage's stdin is available as
+     * first().in, the last stage's output through its output callbacks or last().out.
+     * The stdin of the first stage and stdout of the last one can be redirected like for any Process.
+     */
+    class Pipeline
+    {
+    public:
+        Pipeline() = default;
+
+        /**
+         * Waits for the started stages to exit.
+         */
+        ~Pipeline();
+
+        Pipeline(const Pipeline &) = delete;
+        Pipeline &operator=(const Pipeline &) = delete;
+
+        /**
+         * Appends a stage to the end of the pipeline.
+         * @return The stage's Process, to be configured before start().
+         */
+        Process &addStage(const std::filesystem::path &exePath, const std::vector<std::string> &arguments = {});
+
+        inline Process &stage(size_t index)
+        {
+            return *m_stages.at(index);
+        }
+
+        inline Process &first()
+        {
+            return *m_stages.front();
+        }
+
+        inline Process &last()
+        {
+            return *m_stages.back();
+        }
+
+        inline size_t size() const
+        {
+            return m_stages.size();
+        }
+
+        /**
+         * Sets whether the last stage's stdout is captured (the default, read through last()'s
+         * callbacks or last().out, or as set with last().setStdoutRedirect()) or written directly
+         * to this process's stdout.
+         */
+        inline void setCaptureOutput(bool capture)
+        {
+            m_captureOutput = capture;
+        }
+
+        /**
+         * Starts every stage, connecting them with pipes.
+         * @return 0 on success, -1 on error (exceptions are thrown on errors).
+         */
+        int start();
+
+        /**
+         * Closes the first stage's stdin and waits for every started stage to exit.
+         * @return The exit code of each started stage, in stage order.
+         */
+        std::vector<int> waitForExit();
+
+        /**
+         * Starts the pipeline and waits for every stage to exit.
+         * @return The exit code of each stage, in stage order.
+         */
+        std::vector<int> run();
+
+    private:
+        std::vector<std::unique_ptr<Process>> m_stages;
+        bool m_captureOutput = true;
+        size_t m_startedStages = 0;
+    };
+};
@@ -0,0 +1,105 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <filesystem>
+
+namespace cpplib
+{
+    /**
+     * A command whose argv and environment arrays are built once, for launching the same tool many times,
+     * see Process::setCommand(const PreparedCommand &, std::vector<std::string>).
+     *
+     * prepare() resolves the executable on PATH, applies the environment overrides to a snapshot of this
+     * process's environment and stores every string in a single allocation. A launch then only copies
+     * the argv pointer array and substitutes the slot arguments, nothing is rebuilt or duplicated.
+     *
+     * @code
+     * PreparedCommand cmd("gzip");
+     * cmd.appendArguments({"-k", "-9"});
+     * cmd.appendSlot();                           // the file, different on every launch
+     * cmd.setEnvironmentVariable("GZIP_OPT", "1"); // on top of the inherited environment
+     * cmd.prepare();
+     * proc.setCommand(cmd, {"input.txt"});
+     * @endcode
+     */
+    class PreparedCommand
+    {
+    public:
+        explicit PreparedCommand(const std::filesystem::path &exePath);
+
+        PreparedCommand(const PreparedCommand &) = delete;
+        PreparedCommand &operator=(const PreparedCommand &) = delete;
+        PreparedCommand(PreparedCommand &&) = default;
+        PreparedCommand &operator=(PreparedCommand &&) = default;
+
+        PreparedCommand &appendArgument(const std::string &arg);
+        PreparedCommand &appendArguments(const std::vector<std::string> &args);
+
+        /**
+         * Appends an argument whose value is given on each launch.
+         * @return The slot's index in the values passed to Process::setCommand().
+         */
+        size_t appendSlot();
+
+        /** Sets or replaces a variable of the inherited environment. */
+        PreparedCommand &setEnvironmentVariable(const std::string &name, const std::string &value);
+        /** Removes a variable from the inherited environment. */
+        PreparedCommand &unsetEnvironmentVariable(const std::string &name);
+        /** Starts from an empty environment instead of this process's one. */
+        PreparedCommand &clearEnvironment();
+
+        /**
+         * Builds the arrays, required before the first launch. Call it again after changing the command,
+         * or to pick up later changes to this process's environment.
+         */
+        void prepare();
+
+        bool prepared() const
+        {
+            return m_prepared;
+        }
+
+        size_t slotCount() const
+        {
+            return m_slots.size();
+        }
+
+        /** The path that is executed, resolved on PATH by prepare() on POSIX. argv[0] stays the name given. */
+        const std::string &executable() const
+        {
+            return m_executable;
+        }
+
+        /**
+         * Null-terminated argv with the slots filled from values, which must outlive its use.
+         * Only the pointer array is allocated.
+         */
+        std::vector<char *> argv(const std::vector<std::string> &values) const;
+
+        /** Null-terminated environment, valid as long as this object is not changed. */
+        char *const *envp() const
+        {
+            return m_envp.data();
+        }
+
+    private:
+        struct Variable
+        {
+            std::string name;
+            std::string value;
+            bool unset;
+        };
+
+        std::filesystem::path m_exePath;
+        std::vector<std::string> m_arguments; // without argv[0], slots are empty placeholders
+        std::vector<size_t> m_slots;          // indices into argv
+        std::vector<Variable> m_overrides;
+        bool m_inheritEnvironment = true;
+
+        bool m_prepared = false;
+        std::string m_executable;
+        std::vector<char> m_storage; // every argv and environment string, back to back
+        std::vector<char *> m_argv;
+        std::vector<char *> m_envp;
+    };
+};
@@ -0,0 +1,187 @@
+#pragma once
+#include "ProcessPool.hpp"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cpplib
+{
+    /**
+     * Runs a DAG of ProcessJobs, each node as soon as the nodes it depends on have succeeded,
+     * with a bounded number of concurrently running processes.
+     *
+     * When more nodes are ready than slots are free, the one with the longest remaining path (its own cost
+     * plus the costliest chain of dependents after it) starts first, so the graph's wall-clock time approaches
+     * its critical path. Costs come from earlier runs: every succeeded node's duration is recorded under its
+     * name, and the estimates can be kept across runs with loadCosts() and saveCosts().
+     *
+     * When a node fails, every node depending on it is skipped at once; independent branches keep running
+     * unless setStopOnFailure() is set. Like ProcessPool, the processes are driven by a ProcessReactor on Linux.
+     */
+    class ProcessGraph
+    {
+    public:
+        using NodeId = size_t;
+
+        enum class NodeState
+        {
+            Pending,
+            Running,
+            Succeeded,
+            /** Exited with a non-zero code or could not be started. */
+            Failed,
+            /** Not run because a dependency failed, or stopped by cancel() or setStopOnFailure(). */
+            Skipped,
+        };
+
+        struct Result
+        {
+            NodeId id;
+            NodeState state;
+            /** -1 if the node was not run or could not be started. */
+            int exitCode;
+            /** Set if the node could not be started. */
+            std::string error;
+            std::chrono::microseconds duration;
+        };
+
+        /**
+         * @param maxConcurrent Maximum number of running processes, 0 for the number of cores.
+         */
+        explicit ProcessGraph(size_t maxConcurrent = 0);
+
+        /**
+         * Skips the nodes that have not started and waits for the running ones to finish.
+         */
+        ~ProcessGraph();
+
+        ProcessGraph(const ProcessGraph &) = delete;
+        ProcessGraph &operator=(const ProcessGraph &) = delete;
+
+        /**
+         * Sets the reactor used for the nodes started from now on,
+         * nullptr to use per-process threads instead.
+         */
+        void setReactor(ProcessReactor *reactor);
+
+        /** Skips every node that has not started yet once one fails, instead of only its dependents. */
+        void setStopOnFailure(bool stop);
+
+        /**
+         * Adds a node, only before start(). Its dependencies must have been added already, which keeps the
+         * graph acyclic. ProcessJob::priority only breaks ties between equally long remaining paths.
+         * @param name The key of the node's cost estimate, the command line if empty.
+         */
+        NodeId addNode(ProcessJob job, const std::vector<NodeId> &dependencies = {}, std::string name = {});
+
+        /** Sets the estimated duration of the nodes named name. */
+        void setCost(const std::string &name, std::chrono::microseconds cost);
+        std::optional<std::chrono::microseconds> cost(const std::string &name) const;
+
+        /**
+         * Reads estimates written by saveCosts(), keeping those already set for other names.
+         * A missing file is not an error.
+         */
+        void loadCosts(const std::filesystem::path &path);
+
+        /** Writes every estimate, the ones loaded and the ones measured, to path (replaced atomically). */
+        void saveCosts(const std::filesystem::path &path) const;
+
+        /**
+         * Computes the remaining path lengths and starts the nodes without dependencies.
+         * Nodes without an estimate count as the average of those with one (or all equal if none has).
+         */
+        void start();
+
+        /**
+         * Blocks until a node finishes or is skipped and returns its result, in order of completion.
+         * @return The result, or std::nullopt once every node has one (or if start() was not called).
+         */
+        std::optional<Result> next();
+
+        /**
+         * start() and wait for every node.
+         * @return true if every node succeeded.
+         */
+        bool run();
+
+        /**
+         * Skips every node that has not started yet, running nodes are not affected.
+         * @return The number of skipped nodes.
+         */
+        size_t cancel();
+
+        NodeState state(NodeId id) const;
+
+        /** The longest chain of estimated costs through the graph, known once start() was called. */
+        std::chrono::microseconds criticalPath() const;
+
+        inline size_t maxConcurrent() const
+        {
+            return m_maxConcurrent;
+        }
+
+        size_t size() const;
+        size_t running() const;
+
+    private:
+        struct Node
+        {
+            ProcessJob job;
+            std::string name;
+            std::vector<NodeId> dependents;
+            size_t waitingFor = 0; // dependencies that have not succeeded yet
+            NodeState state = NodeState::Pending;
+            int64_t remainingPath = 0; // microseconds, including the node itself
+            std::chrono::steady_clock::time_point started;
+        };
+
+        struct ReadyNode
+        {
+            int64_t remainingPath;
+            int priority;
+            NodeId id;
+
+            bool operator<(const ReadyNode &other) const
+            {
+                if (remainingPath != other.remainingPath)
+                    return remainingPath < other.remainingPath;
+                if (priority != other.priority)
+                    return priority < other.priority;
+                return id > other.id; // then in order of addition
+            }
+        };
+
+        void fillSlots();
+        void onNodeFinished(NodeId id, int exitCode, std::string error);
+        /** The bookkeeping of onNodeFinished(), without starting the next node. */
+        void recordFinished(NodeId id, int exitCode, std::string error);
+        void skipLocked(NodeId id);
+
+    private:
+        size_t m_maxConcurrent;
+        ProcessReactor *m_reactor = nullptr;
+        bool m_stopOnFailure = false;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_condition;
+        std::vector<Node> m_nodes;
+        std::unordered_map<std::string, int64_t> m_costs; // microseconds, by node name
+        bool m_started = false;
+        std::priority_queue<ReadyNode> m_ready;
+        std::unordered_map<NodeId, std::unique_ptr<Process>> m_running;
+        size_t m_active = 0;
+        size_t m_unfinished = 0; // nodes without a result yet
+        int64_t m_criticalPath = 0;
+        std::deque<Result> m_results;
+        // Finished processes, destroyed outside of their own callbacks.
+        std::vector<std::unique_ptr<Process>> m_finished;
+    };
+};
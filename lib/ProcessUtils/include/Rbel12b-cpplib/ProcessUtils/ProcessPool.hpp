@@ -0,0 +1,121 @@
+#pragma once
+#include "ProcessUtils.hpp"
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+
+namespace cpplib
+{
+    /**
+     * Description of a process to be run by a ProcessPool.
+     */
+    struct ProcessJob
+    {
+        std::filesystem::path command;
+        std::vector<std::string> arguments;
+        /** Environment variables in the form KEY=VALUE, empty to inherit the parent's environment. */
+        std::vector<std::string> environment;
+        std::string workingDirectory;
+        Process::OutputLineCallback outputCallback = nullptr;
+        Process::OutputLineCallback errorCallback = nullptr;
+        /** Queued jobs with a higher priority are started first, equal priorities in submission order. */
+        int priority = 0;
+    };
+
+    /**
+     * Runs ProcessJobs with a bounded number of concurrently running processes,
+     * starting the next queued job as soon as a running one finishes.
+     * On Linux the processes are driven by a ProcessReactor (ProcessReactor::shared() by default),
+     * so the pool does not need any thread per job.
+     */
+    class ProcessPool
+    {
+    public:
+        using JobId = uint64_t;
+
+        struct Result
+        {
+            JobId id;
+            int exitCode;
+            /** Set if the job could not be started, exitCode is -1 in that case. */
+            std::string error;
+        };
+
+        /**
+         * @param maxConcurrent Maximum number of running processes, 0 for the number of cores.
+         */
+        explicit ProcessPool(size_t maxConcurrent = 0);
+
+        /**
+         * Cancels the queued jobs and waits for the running ones to finish.
+         */
+        ~ProcessPool();
+
+        ProcessPool(const ProcessPool &) = delete;
+        ProcessPool &operator=(const ProcessPool &) = delete;
+
+        /**
+         * Sets the reactor used for the jobs started from now on,
+         * nullptr to use per-process threads instead.
+         */
+        void setReactor(ProcessReactor *reactor);
+
+        /**
+         * Queues a job, it is started right away if a slot is free.
+         * @return The id reported in the job's Result.
+         */
+        JobId submit(ProcessJob job);
+
+        /**
+         * Removes a job from the queue, running jobs are not affected.
+         * Cancelled jobs don't produce a Result.
+         * @return true if the job was still queued.
+         */
+        bool cancel(JobId id);
+
+        /**
+         * Removes every queued job.
+         * @return The number of cancelled jobs.
+         */
+        size_t cancelAll();
+
+        /**
+         * Blocks until a job finishes and returns its result, results are returned in order of completion.
+         * @return The result, or std::nullopt if no job is queued or running anymore.
+         */
+        std::optional<Result> next();
+
+        inline size_t maxConcurrent() const
+        {
+            return m_maxConcurrent;
+        }
+
+        size_t queued() const;
+        size_t running() const;
+
+    private:
+        void fillSlots();
+        void onJobFinished(JobId id, int exitCode, std::string error);
+        /** The bookkeeping of onJobFinished(), without starting the next job. */
+        void recordFinished(JobId id, int exitCode, std::string error);
+
+    private:
+        size_t m_maxConcurrent;
+        ProcessReactor *m_reactor = nullptr;
+        JobId m_nextId = 1;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_condition;
+        // Keyed by (-priority, id): highest priority first, then submission order.
+        std::map<std::pair<int, JobId>, ProcessJob> m_queue;
+        std::unordered_map<JobId, int> m_queuedPriority;
+        std::unordered_map<JobId, std::unique_ptr<Process>> m_running;
+        size_t m_active = 0;
+        std::deque<Result> m_results;
+        // Finished processes, destroyed outside of their own callbacks.
+        std::vector<std::unique_ptr<Process>> m_finished;
+    };
+};
@@ -0,0 +1,100 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_set>
+
+namespace cpplib
+{
+    class Process;
+
+    namespace detail
+    {
+        class ProcessCore;
+    }
+
+    /**
+     * Event loop that drives the output pipes and exit notification of many processes
+     * from a fixed number of threads (Linux only, based on epoll and pidfds).
+     * Processes opt in with Process::setReactor(), their output callbacks are then
+     * called on the reactor's threads.
+     *
+     * On kernels without pidfd support, exits are detected through a SIGCHLD handler
+     * that writes to a self-pipe, the previously installed handler is still called.
+     *
+     * If the event loop itself fails (epoll_wait() with an error other than EINTR, e.g. because its fd was
+     * closed behind its back), its threads stop and every process it drives is handed over to per-process
+     * IO and monitor threads, as without a reactor, so none is left without completion. Processes attached
+     * later are handed over at once. error() tells the owner.
+     */
+    class ProcessReactor
+    {
+    public:
+        /**
+         * Starts the event loop threads.
+         * @param threadCount Number of event loop threads, at least 1.
+         */
+        explicit ProcessReactor(unsigned threadCount = 1);
+
+        /**
+         * Stops the event loop threads.
+         * All processes using the reactor must have been waited for before.
+         */
+        ~ProcessReactor();
+
+        ProcessReactor(const ProcessReactor &) = delete;
+        ProcessReactor &operator=(const ProcessReactor &) = delete;
+
+        /**
+         * A process-wide reactor with a single thread, created on first use.
+         */
+        static ProcessReactor &shared();
+
+        inline size_t threadCount() const
+        {
+            return m_threads.size();
+        }
+
+        /** The errno the event loop failed with, 0 while it is working. */
+        inline int error() const
+        {
+            return m_error;
+        }
+
+    private:
+        friend class detail::ProcessCore;
+
+        struct Watch;
+
+        void attach(detail::ProcessCore *proc);
+        void run();
+        void handleStream(Watch *watch);
+        void handleExit(Watch *watch);
+        void handleChildSignal();
+        void add(Watch *watch, int fd);
+        void rearm(Watch *watch, int fd);
+        void remove(int fd);
+        /** Records the failure and hands every armed watch and pending exit over, once. */
+        void fail(int error);
+        /** Drives watch's stream or exit from a thread of the process's own, then deletes it. */
+        void handOver(Watch *watch);
+
+    private:
+        int m_epollFd = -1;
+        int m_stopFd = -1;
+        int m_signalPipe[2] = {-1, -1};
+        int m_signalSlot = -1;
+        Watch *m_signalWatch = nullptr;
+        std::vector<std::thread> m_threads;
+
+        // Watches registered with epoll and not being handled, handed over if the loop fails.
+        std::mutex m_watchMutex;
+        std::unordered_set<Watch *> m_armed;
+        std::atomic<int> m_error{0};
+
+        // Exit watches for processes without a pidfd, scanned on SIGCHLD.
+        std::mutex m_pendingMutex;
+        std::vector<Watch *> m_pendingExits;
+    };
+};
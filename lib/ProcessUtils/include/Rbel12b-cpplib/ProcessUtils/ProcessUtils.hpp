@@ -1,21 +1,40 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
 #include <filesystem>
 #include <functional>
 #include <streambuf>
-#include <vector>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <limits>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include "OutputTail.hpp"
+#include "PreparedCommand.hpp"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define CPPLIB_PROCESS_COROUTINES 1
+#endif
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <sys/types.h>
 #endif
 
 namespace cpplib
 {
     class fd_streambuf : public std::streambuf
     {
-        static const size_t buf_size = 4096;
         std::vector<char> buffer;
 #ifdef _WIN32
         HANDLE handle;
@@ -23,116 +42,597 @@ namespace cpplib
         int fd;
 #endif
         bool readable;
+        bool at_eof = false;
+        uint64_t transferred = 0;
+
+        /** Reads into dst, returns the bytes read, 0 at EOF (setting at_eof) or -1 if a non-blocking fd has no data. */
+        std::streamsize readSome(char *dst, size_t size);
+        /** Writes all of data, retrying short writes. */
+        bool writeAll(const char *data, size_t size);
 
     public:
+        static const size_t buf_size = 4096;
+
+        /**
+         * @param size Size of the read or write buffer, 0 for buf_size. Larger buffers mean fewer
+         * syscalls for high-volume streams, xsgetn()/xsputn() bypass it for requests at least as large.
+         */
 #ifdef _WIN32
-        fd_streambuf(HANDLE h, bool read_mode);
+        fd_streambuf(HANDLE h, bool read_mode, size_t size = buf_size);
 #else
-        fd_streambuf(int f, bool read_mode);
+        fd_streambuf(int f, bool read_mode, size_t size = buf_size);
 #endif
 
         int sync() override;
         int overflow(int ch) override;
         int underflow() override;
+        std::streamsize xsgetn(char *s, std::streamsize n) override;
+        std::streamsize xsputn(const char *s, std::streamsize n) override;
         size_t available() const;
         bool hasData() const;
-    };
-    class Process
-    {
-    public:
-        using OutputLineCallback = std::function<void(const std::string &)>;
 
-        ~Process();
+        /** Bytes read from or written to the fd so far. */
+        uint64_t bytesTransferred() const
+        {
+            return transferred;
+        }
 
-        inline void setCommand(const std::filesystem::path &exePath)
+        /**
+         * Returns the currently buffered bytes and marks them as consumed,
+         * reading from the fd first if the buffer is empty.
+         * The view points into the internal buffer and stays valid until the next read from this buffer.
+         * An empty view means EOF, or no data yet on a non-blocking fd (see atEof()).
+         */
+        std::string_view readChunk();
+
+        /**
+         * True once a read returned end of file or a non-retryable error.
+         */
+        bool atEof() const
         {
-            m_exePath = exePath;
+            return at_eof;
         }
+    };
 
+    /**
+     * Describes what a standard stream of a child process is connected to,
+     * see Process::setStdinRedirect(), setStdoutRedirect() and setStderrRedirect().
+     * Everything except Kind::Pipe is only supported on POSIX.
+     */
+    struct StreamRedirect
+    {
+        enum class Kind
+        {
+            /** A pipe to this process, used through the Process streams and callbacks (default). */
+            Pipe,
+            /** The parent's own stdin/stdout/stderr. */
+            Inherit,
+            /** /dev/null */
+            Null,
+            /** A file, read for stdin, truncated or appended to for stdout/stderr. */
+            File,
+            /** An fd owned by the caller, it only has to stay open until start() returns. */
+            Fd,
+            /**
+             * stdout/stderr only: a pipe whose data is moved into a file with splice(2),
+             * without passing through a user-space buffer. The stream's callbacks are not called.
+             * Use File instead when the child may write to the file itself. If writing the file fails
+             * (e.g. a full disk), the rest of the stream is discarded and the errno is in ProcessStats.
+             */
+            CaptureToFile,
+        };
+
+        Kind kind = Kind::Pipe;
+        std::filesystem::path path;
+        bool append = false;
+        int fd = -1;
+        /** Pipe and CaptureToFile: size of the Process::in/out/err stream buffer, 0 for fd_streambuf::buf_size. */
+        size_t bufferSize = 0;
         /**
-         * Sets the command to execute by parsing a command line string, note that
-         * the parser splits arguments by spaces and does not handle complex shell features. (eg. quoting ...)
-         * @param cmd The command line string to parse.
+         * Pipe and CaptureToFile: capacity requested for the pipe (F_SETPIPE_SZ on Linux, the CreatePipe size
+         * on Windows), 0 for the system default. Best effort, Linux caps it at /proc/sys/fs/pipe-max-size.
          */
-        inline void setCommand(const std::string &cmd)
+        size_t pipeSize = 0;
+
+        static StreamRedirect pipe(size_t bufferSize = 0, size_t pipeSize = 0)
         {
-            auto argv = buildArgv(cmd);
-            if (!argv.empty())
-            {
-                m_exePath = argv[0];
-                m_arguments.assign(argv.begin() + 1, argv.end());
-            }
+            StreamRedirect redirect;
+            redirect.bufferSize = bufferSize;
+            redirect.pipeSize = pipeSize;
+            return redirect;
+        }
+
+        static StreamRedirect inherit()
+        {
+            return {Kind::Inherit, {}, false, -1};
+        }
+
+        static StreamRedirect null()
+        {
+            return {Kind::Null, {}, false, -1};
+        }
+
+        static StreamRedirect file(const std::filesystem::path &path, bool append = false)
+        {
+            return {Kind::File, path, append, -1};
+        }
+
+        static StreamRedirect fromFd(int fd)
+        {
+            return {Kind::Fd, {}, false, fd};
+        }
+
+        static StreamRedirect captureToFile(const std::filesystem::path &path, bool append = false)
+        {
+            return {Kind::CaptureToFile, path, append, -1};
         }
+    };
 
-        inline void clearArguments()
+    /**
+     * How the output of a stream is split into the records passed to the line callbacks,
+     * see Process::setOutputFraming() and setErrorFraming().
+     */
+    struct RecordFraming
+    {
+        enum class Kind
+        {
+            /** Records end with delimiter, which is included in the record (like the newline of a line). */
+            Delimiter,
+            /**
+             * Each record is a 4-byte unsigned length followed by that many bytes, the record passed
+             * to the callback is the payload only. The length is trusted, an incomplete last record is dropped.
+             */
+            LengthPrefixed,
+        };
+
+        Kind kind = Kind::Delimiter;
+        char delimiter = '\n';
+        bool bigEndian = true; // byte order of the length prefix
+
+        static RecordFraming newline()
         {
-            m_arguments.clear();
+            return {};
         }
 
-        inline void appendArgument(const std::string &arg)
+        /** NUL-terminated records, as written by `find -print0` or `git ls-files -z`. */
+        static RecordFraming nul()
         {
-            m_arguments.push_back(arg);
+            return byte('\0');
         }
 
-        inline void appendArguments(const std::vector<std::string> &argv)
+        static RecordFraming byte(char delimiter)
         {
-            m_arguments.insert(m_arguments.end(), argv.begin(), argv.end());
+            return {Kind::Delimiter, delimiter, true};
         }
 
-        inline void setWorkingDirectory(const std::string &path)
+        static RecordFraming lengthPrefixed(bool bigEndian = true)
+        {
+            return {Kind::LengthPrefixed, '\n', bigEndian};
+        }
+    };
+
+    class ProcessReactor;
+    class CachedRunner;
+    class SharedRing;
+
+    namespace detail
+    {
+        class CompletionWait;
+        class ProcessCore;
+    }
+
+    /**
+     * Selects how a child process is created on POSIX systems.
+     * Ignored on Windows, where CreateProcess is always used.
+     */
+    enum class SpawnBackend
+    {
+        /** Plain fork() followed by exec in the child. Copies the parent's page tables. */
+        Fork,
+        /**
+         * clone(CLONE_VM | CLONE_VFORK) on Linux: the child borrows the parent's address space
+         * until exec, so the cost does not grow with the parent's memory size.
+         * Falls back to Fork on other POSIX systems.
+         */
+        Vfork,
+        /** posix_spawn()/posix_spawnp() from the C library. */
+        PosixSpawn,
+        /**
+         * Hands the spawn to the helper started with SpawnServer::start() (Linux only), whose
+         * small address space keeps launches fast however large this process has grown.
+         * The helper handles one spawn at a time, concurrent start() calls wait for each other.
+         */
+        Server,
+    };
+
+    /** CPU scheduling policy of a child, see Process::setSchedulingPolicy() (Linux). */
+    enum class SchedulingPolicy
+    {
+        /** This process's policy. */
+        Inherit,
+        /** SCHED_BATCH: weighted by the nice value like normal threads, but treated as CPU-bound and preempts less. */
+        Batch,
+        /** SCHED_IDLE: only runs when no other thread wants the CPU. */
+        Idle,
+    };
+
+    /** I/O scheduling class of a child, see Process::setIoPriority() (Linux). */
+    enum class IoPriorityClass
+    {
+        /** This process's I/O priority. */
+        Inherit,
+        /** Served in turn with normal processes, at a level from 0 (highest) to 7. */
+        BestEffort,
+        /** Only served when no other process is doing I/O. */
+        Idle,
+    };
+
+    /** A setrlimit() limit applied to a child before exec, see Process::setResourceLimit() (POSIX). */
+    struct ResourceLimit
+    {
+        /** RLIMIT_AS, RLIMIT_NOFILE, RLIMIT_CPU... */
+        int resource;
+        uint64_t soft;
+        uint64_t hard;
+
+        /** RLIM_INFINITY */
+        static constexpr uint64_t unlimited = std::numeric_limits<uint64_t>::max();
+    };
+
+    /** Options for Process::communicate(). */
+    struct CommunicateOptions
+    {
+        /** Capacity reserved up front for the captured output and error output. */
+        size_t outputReserve = 0;
+        size_t errorReserve = 0;
+        /** Bytes kept at most, the rest is still read (so the child never blocks) but discarded. */
+        size_t maxOutputSize = std::numeric_limits<size_t>::max();
+        size_t maxErrorSize = std::numeric_limits<size_t>::max();
+    };
+
+    /** Result of Process::communicate(). */
+    struct CommunicateResult
+    {
+        int exitCode = -1;
+        std::string output;
+        std::string error;
+        bool outputTruncated = false;
+        bool errorTruncated = false;
+    };
+
+    /**
+     * Resource usage and lifecycle timing of a process, see Process::stats().
+     * Timestamps of events that did not happen (e.g. no output) stay at the clock's epoch.
+     */
+    struct ProcessStats
+    {
+        using Clock = std::chrono::steady_clock;
+
+        Clock::time_point spawnStarted;  // start() began creating the child
+        Clock::time_point execCompleted; // the child's exec succeeded
+        Clock::time_point firstOutput;   // the first stdout or stderr byte was read
+        Clock::time_point exited;        // the exit was detected
+
+        // From wait4()-style rusage on POSIX, only the CPU times on Windows.
+        std::chrono::microseconds userTime{0};
+        std::chrono::microseconds systemTime{0};
+        long maxResidentKb = 0;
+        long minorFaults = 0;
+        long majorFaults = 0;
+        long voluntaryContextSwitches = 0;
+        long involuntaryContextSwitches = 0;
+
+        uint64_t stdinBytes = 0;
+        uint64_t stdoutBytes = 0;
+        uint64_t stderrBytes = 0;
+
+        // errno of a failed CaptureToFile write, 0 if the whole stream reached its file.
+        int stdoutCaptureError = 0;
+        int stderrCaptureError = 0;
+
+        Clock::duration spawnLatency() const
         {
-            m_workingDirectory = path;
+            return execCompleted - spawnStarted;
         }
 
-        inline void setDetached(bool detached = true)
+        Clock::duration runTime() const
         {
-            m_detached = detached;
+            return exited - execCompleted;
         }
+    };
+
+    /** A record of the merged stdout/stderr stream, see Process::setOutputEventCallback(). */
+    struct OutputEvent
+    {
+        enum class Stream
+        {
+            Stdout,
+            Stderr,
+        };
+
+        Stream stream = Stream::Stdout;
+        /** When the read that completed the record returned. */
+        ProcessStats::Clock::time_point time;
+        /** The record, framed as set with Process::setOutputFraming()/setErrorFraming(). */
+        std::string data;
+    };
+
+    /** How Process::terminate() stops a process. */
+    struct TerminationPolicy
+    {
+        /** Sent first, so the process can shut down cleanly (ignored on Windows). */
+        int signal = SIGTERM;
+        /** Time given to the process to exit after the first signal, before it is killed with SIGKILL. */
+        std::chrono::milliseconds gracePeriod{5000};
+        /**
+         * Signal the whole process group, requires Process::setProcessGroup(true).
+         * Otherwise descendants that keep the output pipes open delay the return until they exit.
+         */
+        bool processGroup = false;
+    };
+
+    class Process
+    {
+    public:
+        using OutputLineCallback = std::function<void(const std::string &)>;
+        using OutputChunkCallback = std::function<void(std::string_view chunk)>;
+        using ExitCallback = std::function<void(int exitCode)>;
+        using OutputEventCallback = std::function<void(const OutputEvent &event)>;
+
+        Process();
+        ~Process();
+
+        /**
+         * Moves the process, running or not, to another handle. Its IO threads, reactor registration,
+         * callbacks and pending awaiters are unaffected. A moved-from Process may only be destroyed
+         * or assigned to; assigning to a Process first waits for its own child, like destroying it.
+         * Movability costs one extra heap allocation per Process, made by Process() for the state the
+         * threads point to. The handle is not small either: the three iostream members take a few
+         * hundred bytes each, only the state behind the pointer is not copied by a move.
+         */
+        Process(Process &&other) noexcept;
+        Process &operator=(Process &&other) noexcept;
+
+        void setCommand(const std::filesystem::path &exePath);
+
+        /**
+         * Sets the command to execute by parsing a command line string, note that
+         * the parser splits arguments by spaces and does not handle complex shell features. (eg. quoting ...)
+         * @param cmd The command line string to parse.
+         */
+        void setCommand(const std::string &cmd);
+
+        /**
+         * Sets a command prepared with PreparedCommand::prepare(), launched without rebuilding its
+         * argv and environment. It replaces the command, arguments and environment set on this Process.
+         * @param cmd The command, it must outlive every start() of this Process.
+         * @param slotValues The values of the slots added with PreparedCommand::appendSlot(), in order.
+         */
+        void setCommand(const PreparedCommand &cmd, std::vector<std::string> slotValues = {});
+
+        void clearArguments();
+
+        void appendArgument(const std::string &arg);
+
+        void appendArguments(const std::vector<std::string> &argv);
+
+        void setWorkingDirectory(const std::string &path);
+
+        void setDetached(bool detached = true);
+
+        /**
+         * Starts the process as the leader of a new process group (POSIX), so that
+         * sendSignal() and terminate() can reach the processes it starts too.
+         */
+        void setProcessGroup(bool newGroup);
+
+#ifndef _WIN32
+        /**
+         * Sets the child's nice value, from -20 (most CPU) to 19 (least). Going below this process's
+         * own value needs privileges, start() throws otherwise. POSIX only.
+         */
+        void setNice(int nice);
+
+        /**
+         * Sets a setrlimit() limit of the child, e.g. RLIMIT_AS to cap its memory, replacing an earlier one
+         * for the same resource. Raising a hard limit needs privileges, start() throws otherwise. POSIX only.
+         */
+        void setResourceLimit(int resource, uint64_t soft, uint64_t hard = ResourceLimit::unlimited);
+#endif
+
+#ifdef __linux__
+        /** Restricts the child to the given CPUs, an empty list keeps this process's affinity (Linux). */
+        void setCpuAffinity(const std::vector<int> &cpus);
+
+        /** Sets the child's CPU scheduling policy, the nice value still weighs Batch children (Linux). */
+        void setSchedulingPolicy(SchedulingPolicy policy);
+
+        /**
+         * Sets the child's I/O priority with ioprio_set(2) (Linux).
+         * @param level 0 (highest) to 7, only used for IoPriorityClass::BestEffort.
+         */
+        void setIoPriority(IoPriorityClass ioClass, int level = 4);
+
+        /**
+         * Makes the child join a cgroup v2 before exec, e.g. a directory with memory.max or cpu.max set,
+         * so the limits apply from its first instruction. The directory must exist and be writable by
+         * this process (a delegated subtree), start() throws otherwise. Empty to stay in this process's cgroup (Linux).
+         */
+        void setCgroup(const std::filesystem::path &dir);
+#endif
+
+        /**
+         * Selects the mechanism used by start() to create the child process (POSIX only).
+         * With every backend a failed exec makes start() throw immediately,
+         * instead of the child exiting with code 127.
+         * @param backend The spawn backend, defaults to SpawnBackend::Vfork.
+         */
+        void setSpawnBackend(SpawnBackend backend);
+
+        /**
+         * Sets what the process's stdin is connected to, a pipe written through `in` by default.
+         * In detached mode a pipe becomes /dev/null.
+         */
+        void setStdinRedirect(const StreamRedirect &redirect);
+
+        /**
+         * Sets what the process's stdout is connected to, a pipe read through `out`/the callbacks by default.
+         * In detached mode a pipe becomes /dev/null.
+         */
+        void setStdoutRedirect(const StreamRedirect &redirect);
+
+        /**
+         * Sets what the process's stderr is connected to, a pipe read through `err`/the callbacks by default.
+         * In detached mode a pipe becomes /dev/null.
+         */
+        void setStderrRedirect(const StreamRedirect &redirect);
+
+        const StreamRedirect &getStdinRedirect() const;
+
+        const StreamRedirect &getStdoutRedirect() const;
+
+        const StreamRedirect &getStderrRedirect() const;
+
+        /**
+         * Lets a shared ProcessReactor read the process's output and detect its exit,
+         * instead of the per-process monitor and IO threads (POSIX/Linux only).
+         * In this mode the out/err streams are consumed by the reactor and callbacks run on its threads.
+         * The reactor must outlive the process.
+         * @param reactor The reactor to use, or nullptr for per-process threads (default).
+         */
+        void setReactor(ProcessReactor *reactor);
 
         /**
          * Sets a callback function to be called for each line of output captured from the process.
          * The callback is called on the same thread as run().
          * @param callback The callback function.
          */
-        inline void setOutputCallback(std::function<void(const std::string &)> callback)
-        {
-            m_outputCallback = callback;
-        }
+        void setOutputCallback(std::function<void(const std::string &)> callback);
 
         /**
          * Sets a callback function to be called for each line of error output captured from the process.
          */
-        inline void setErrorCallback(std::function<void(const std::string &)> callback)
-        {
-            m_errorCallback = callback;
-        }
+        void setErrorCallback(std::function<void(const std::string &)> callback);
+
+        /**
+         * Sets a callback function to be called with raw chunks of the process's output, as read from the pipe.
+         * No line splitting or copying is done: the view points into the stream's read buffer
+         * and is only valid until the callback returns, chunks may end in the middle of a line.
+         * When set, it replaces the line callback set with setOutputCallback().
+         */
+        void setOutputChunkCallback(OutputChunkCallback callback);
+
+        /**
+         * Same as setOutputChunkCallback() for the error output, replaces the line callback set with setErrorCallback().
+         */
+        void setErrorChunkCallback(OutputChunkCallback callback);
+
+        /**
+         * Sets a callback function to be called once the process has exited and all of its
+         * output was delivered to the output/error callbacks, just before waitForExit() returns.
+         * The callback runs on the thread that observed the completion (monitor, IO or reactor thread),
+         * it must not destroy the Process.
+         */
+        void setExitCallback(ExitCallback callback);
+
+        /**
+         * Merges stdout and stderr into one stream of timestamped records passed to callback, one call at a time,
+         * instead of the output and error line callbacks (chunk callbacks still take precedence).
+         * In the default thread mode one thread polls both pipes (POSIX), so the records arrive in the order
+         * they were read; with a reactor that holds with a single reactor thread.
+         */
+        void setOutputEventCallback(OutputEventCallback callback);
+
+        /**
+         * Like setOutputEventCallback(), but keeps the records for outputEvents() (after the callback, if both are set).
+         * The records are not bounded, see setOutputTail() for a bounded capture.
+         */
+        void setCollectOutputEvents(bool collect);
+
+        /** The records collected with setCollectOutputEvents(), complete once waitForExit() has returned. */
+        const std::vector<OutputEvent> &outputEvents() const;
+
+        /**
+         * Sets how the output is split into the records passed to the output callback (and queued for readLine()),
+         * lines by default. Delimiters are found with memchr(), which the C library vectorises.
+         */
+        void setOutputFraming(const RecordFraming &framing);
+
+        /**
+         * Same as setOutputFraming() for the records passed to the error callback.
+         */
+        void setErrorFraming(const RecordFraming &framing);
+
+        /**
+         * Sets whether the output lines are queued for readLine() (C++20) instead of being passed
+         * to the output callback. A chunk callback set with setOutputChunkCallback() still takes precedence.
+         */
+        void setQueueOutputLines(bool queue);
+
+        /**
+         * Keeps the last maxBytes bytes (and at most maxLines lines, 0 for no line limit) of the output
+         * in a ring buffer allocated once at start(), readable with outputTail() after waitForExit().
+         * Works with every way of consuming the output except CaptureToFile and reading `out` directly;
+         * the callbacks are still called. 0 bytes (default) disables it.
+         */
+        void setOutputTail(size_t maxBytes, size_t maxLines = 0);
+
+        /**
+         * Same as setOutputTail() for the error output, e.g. to show the last lines of stderr when a tool fails.
+         */
+        void setErrorTail(size_t maxBytes, size_t maxLines = 0);
+
+        /** The output kept by setOutputTail(), complete once waitForExit() has returned. */
+        const OutputTail &outputTail() const;
+
+        /** The error output kept by setErrorTail(), complete once waitForExit() has returned. */
+        const OutputTail &errorTail() const;
 
         /**
          * Sets environment variables for the new process in the form KEY=VALUE,
          * this function overwrites any previously set environment variables.
          * @param env A vector of environment variable strings.
          */
-        inline void setEnvironment(const std::vector<std::string> &env)
-        {
-            m_environment = env;
-            if (!env.empty())
-                m_hasCustomEnvironment = true;
-        }
+        void setEnvironment(const std::vector<std::string> &env);
 
         /**
          * Adds a single environment variable in the form KEY=VALUE
          * @param envVar The environment variable string.
          */
-        inline void pushEnvironmentVariable(const std::string &envVar)
-        {
-            m_environment.push_back(envVar);
-            m_hasCustomEnvironment = true;
-        }
+        void pushEnvironmentVariable(const std::string &envVar);
 
-        inline int getExitCode() const
-        {
-            return m_exitCode;
-        }
+#ifndef _WIN32
+        /**
+         * Gives the child parentFd as fd number childFd, e.g. a pipe for results next to stdout.
+         * childFd must be 3 or above (0-2 are set with the stream redirects) and used once,
+         * parentFd only has to stay open until start() returns. POSIX only.
+         */
+        void mapFd(int parentFd, int childFd);
+
+        void clearFdMappings();
+
+        /**
+         * Closes every fd of the child except 0-2, the mapped ones and shared rings before exec, so fds
+         * the host leaks without close-on-exec never reach it (and cannot hold a pipe open). Uses
+         * close_range(2) or a scan of the open fds, so the cost does not grow with the host's fd count.
+         * Off by default, which keeps the POSIX behaviour of inheriting every fd without close-on-exec. POSIX only.
+         */
+        void setCloseOtherFds(bool close);
+#endif
+
+#ifdef __linux__
+        /**
+         * Hands ring to the child: its fd stays open across exec at the same number and the environment variable
+         * envName holds that number, see SharedRing::fromEnvironment(). The ring must stay open until start() returns.
+         * Include SharedRing.hpp to create one.
+         */
+        void shareRing(const SharedRing &ring, const std::string &envName);
+
+        /** Stops handing the rings added with shareRing() to children started from now on. */
+        void clearSharedRings();
+#endif
+
+        int getExitCode() const;
 
         /**
          * Runs the configured process and waits for it to finish.
@@ -141,6 +641,14 @@ namespace cpplib
          */
         int run();
 
+        /**
+         * Runs the configured process like run(), terminating it with policy if it has not
+         * finished within timeout.
+         * @return 0 if the process finished in time, -1 if it was terminated or on error
+         * (exceptions are thrown on errors). The exit code is available from getExitCode().
+         */
+        int run(std::chrono::milliseconds timeout, const TerminationPolicy &policy = {});
+
         /**
          * Starts the configured process without waiting for it to finish.
          * In detached mode the process is fully detached from the parent.
@@ -153,27 +661,164 @@ namespace cpplib
          */
         int start();
 
+        /**
+         * Starts the configured process like start(), without tying up a thread to wait for it.
+         * The returned future becomes ready with the exit code once the process has exited and
+         * its output was delivered, waitForExit() or the destructor still releases its resources.
+         * @return A future for the process's exit code (exceptions are thrown on start errors).
+         */
+        std::future<int> startAsync();
+
+        /**
+         * Starts the process, writes input to its stdin and closes it, captures its stdout and stderr
+         * and waits for it to exit, like Python's Popen.communicate(). On POSIX everything is
+         * multiplexed with poll() on the calling thread, so large inputs and outputs cannot deadlock
+         * and no IO or monitor thread is started; the output/error callbacks are not called.
+         * Streams redirected elsewhere than a pipe are left untouched (and their result is empty).
+         * @param input Written to stdin, must be empty unless stdin is a pipe.
+         * @return The exit code and captured output (exceptions are thrown on errors).
+         */
+        CommunicateResult communicate(std::string_view input = {}, const CommunicateOptions &options = {});
+
         /**
          * Waits for the started process to exit and retrieves its exit code.
          * Should be called only for non-detached processes started with start().
+         * Closes the process's stdin first, and returns only after the output/error
+         * callbacks have received all of the process's output.
          * @return The exit code of the process, or -1 on error (exceptions are thrown on errors).
          */
         int waitForExit();
 
-        bool running() const
+        /**
+         * Flushes Process::in and closes the process's stdin, so that it sees EOF.
+         * waitForExit() does this itself, waitFor() and waitUntil() leave stdin open.
+         */
+        void closeInput();
+
+        /**
+         * Like waitForExit(), but gives up once deadline has passed. stdin is only closed once the process
+         * has exited, a process that reads it until EOF needs closeInput() first.
+         * The wait is woken by the exit detection itself, it does not poll.
+         * @return The exit code, std::nullopt if the process is still running at the deadline,
+         * or -1 if it was not started or is detached.
+         */
+        std::optional<int> waitUntil(std::chrono::steady_clock::time_point deadline);
+
+        /**
+         * Like waitForExit(), but gives up after timeout, see waitUntil().
+         * @return The exit code, std::nullopt if the process is still running, or -1 if it was not started.
+         */
+        inline std::optional<int> waitFor(std::chrono::milliseconds timeout)
         {
-            return m_running;
+            return waitUntil(std::chrono::steady_clock::now() + timeout);
         }
 
-        bool outputAvailable() const
+        /**
+         * Sends policy.signal, waits up to policy.gracePeriod, then sends SIGKILL and waits for the exit.
+         * On Windows the process is terminated immediately.
+         * @return The exit code of the process, -1 if it was not started or is detached.
+         */
+        int terminate(const TerminationPolicy &policy = {});
+
+        /**
+         * Sends signal to the running process (POSIX, on Linux through its pidfd so a reused pid is never hit),
+         * or to its whole process group if processGroup is set and it was started with setProcessGroup(true).
+         * On Windows the process is terminated whatever the signal.
+         * @return true if the signal was sent.
+         */
+        bool sendSignal(int signal, bool processGroup = false);
+
+        /**
+         * Resource usage, timestamps and byte counts of the last run, complete once waitForExit() has returned.
+         */
+        ProcessStats stats() const;
+
+        bool running() const;
+
+        bool outputAvailable() const;
+
+        bool errorAvailable() const;
+
+#ifdef CPPLIB_PROCESS_COROUTINES
+        /** Awaitable returned by exited(). */
+        class ExitAwaiter
+        {
+        public:
+            explicit ExitAwaiter(detail::ProcessCore &core) : m_core(core) {}
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                bool suspended = addCompletionHandler(m_core, [this, handle](int exitCode)
+                                                      {
+                    m_exitCode = exitCode;
+                    handle.resume(); });
+                if (!suspended)
+                    m_exitCode = exitCodeOf(m_core);
+                return suspended;
+            }
+
+            int await_resume() const noexcept
+            {
+                return m_exitCode;
+            }
+
+        private:
+            detail::ProcessCore &m_core;
+            int m_exitCode = -1;
+        };
+
+        /** Awaitable returned by readLine(). */
+        class LineAwaiter
         {
-            return m_stdoutBuf && (m_stdoutBuf->available() || m_stdoutBuf->hasData());
+        public:
+            explicit LineAwaiter(detail::ProcessCore &core) : m_core(core) {}
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                return !lineReady(m_core, [handle]()
+                                  { handle.resume(); });
+            }
+
+            std::optional<std::string> await_resume()
+            {
+                return popLine(m_core);
+            }
+
+        private:
+            detail::ProcessCore &m_core;
+        };
+
+        /**
+         * `co_await proc.exited()` suspends the coroutine until the process has exited and its
+         * output was delivered, and yields the exit code.
+         * The coroutine is resumed on the thread that observed the completion (see setExitCallback()).
+         */
+        ExitAwaiter exited()
+        {
+            return ExitAwaiter(*m_core);
         }
 
-        bool errorAvailable() const
+        /**
+         * `co_await proc.readLine()` yields the next stdout line (with its newline), or std::nullopt
+         * once stdout is closed. Requires setQueueOutputLines(true) before start().
+         * The coroutine is resumed on the thread reading the output: it must not destroy the Process
+         * before readLine() has yielded std::nullopt or exited() has completed.
+         */
+        LineAwaiter readLine()
         {
-            return m_stderrBuf && (m_stderrBuf->available() || m_stderrBuf->hasData());
+            return LineAwaiter(*m_core);
         }
+#endif
 
     public:
         /**
@@ -196,59 +841,17 @@ namespace cpplib
         std::istream err = std::istream(nullptr);
 
     private:
-        std::vector<std::string> buildArgv(const std::string &cmd) const;
-        void monitorProcess();
-        void onProcessExit();
-
-        void closePipes();
+        friend class detail::CompletionWait;
+        friend class CachedRunner;
 
-        void startIOThreads();
+        void takeCore(Process &other);
 
-#ifdef _WIN32
-        wchar_t* buildEnvironmentBlock();
-#else
-        void closePipe(int pipeFd[2], bool openFlags[2], int endsToClose = 2);
-
-        char *const *buildArgvArray(const std::vector<std::string> &argv) const;
-        void freeArgvArray(char *const *argv) const;
-#endif
-
-    private:
-        std::filesystem::path m_exePath;
-        std::vector<std::string> m_arguments;
-        std::string m_workingDirectory;
-        std::vector<std::string> m_environment;
-        bool m_hasCustomEnvironment = false;
-        bool m_detached = false;
-        OutputLineCallback m_outputCallback = nullptr;
-        OutputLineCallback m_errorCallback = nullptr;
-        int m_exitCode = -1;
-#ifndef _WIN32
-        int m_stdOutPipe[2];
-        bool m_stdOutPipeOpen[2] = {false, false};
-        int m_stdErrPipe[2];
-        bool m_stdErrPipeOpen[2] = {false, false};
-        int m_stdInPipe[2];
-        bool m_stdInPipeOpen[2] = {false, false};
-#else
-        bool m_stdOutPipeOpen = false;
-        bool m_stdErrPipeOpen = false;
-        bool m_stdInPipeOpen = false;
-        HANDLE hStdOutRd = INVALID_HANDLE_VALUE;
-        HANDLE hStdErrRd = INVALID_HANDLE_VALUE;
-        HANDLE hStdInWr = INVALID_HANDLE_VALUE;
-#endif
-        bool m_running = false;
-        pid_t m_pid = -1;
-        std::thread m_monitorThread;
-
-#ifdef _WIN32
-        HANDLE m_processHandle = INVALID_HANDLE_VALUE;
-        HANDLE m_threadHandle = INVALID_HANDLE_VALUE;
-#endif
+        // For the awaiters, which hold the core so that they survive moves of the Process.
+        static bool addCompletionHandler(detail::ProcessCore &core, std::function<void(int)> handler);
+        static int exitCodeOf(const detail::ProcessCore &core);
+        static bool lineReady(detail::ProcessCore &core, std::function<void()> waiter);
+        static std::optional<std::string> popLine(detail::ProcessCore &core);
 
-        fd_streambuf* m_stdinBuf = nullptr;
-        fd_streambuf* m_stdoutBuf = nullptr;
-        fd_streambuf* m_stderrBuf = nullptr;
+        std::unique_ptr<detail::ProcessCore> m_core;
     };
 };
\ No newline at end of file
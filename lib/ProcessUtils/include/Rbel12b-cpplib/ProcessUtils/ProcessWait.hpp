@@ -0,0 +1,46 @@
+#pragma once
+#include "ProcessUtils.hpp"
+#include <optional>
+#include <vector>
+
+namespace cpplib
+{
+    /** A completed process and its exit code, see waitAny() and waitAll(). */
+    struct ProcessExit
+    {
+        Process *process = nullptr;
+        int exitCode = -1;
+    };
+
+    /**
+     * Blocks until one of processes has exited and its output was delivered (the point where
+     * waitForExit() would return), like waitForExit() on whichever finishes first.
+     * The call registers once with every process and is then woken by the first completion,
+     * nothing is polled. Processes that already completed are returned immediately, so remove
+     * a returned process from the set before waiting again; processes that were not started or
+     * are detached are ignored. Like waitForExit(), it closes the stdin of every process it waits
+     * for, so children reading it until EOF can finish. Call waitForExit() on the returned process
+     * to release its resources, it returns at once.
+     * @return The completed process, or std::nullopt if processes contains none that can complete.
+     */
+    std::optional<ProcessExit> waitAny(const std::vector<Process *> &processes);
+
+    /**
+     * Like waitAny(), but gives up after timeout. stdin is left open like waitFor() leaves it,
+     * a process that reads it until EOF needs closeInput() first.
+     * @return The completed process, or std::nullopt if none completed in time.
+     */
+    std::optional<ProcessExit> waitAny(const std::vector<Process *> &processes, std::chrono::milliseconds timeout);
+
+    /**
+     * Blocks until every process that can complete (see waitAny()) has completed, closing their stdin.
+     * @return The completed processes, in the order they completed (already completed ones first).
+     */
+    std::vector<ProcessExit> waitAll(const std::vector<Process *> &processes);
+
+    /**
+     * Like waitAll(), but gives up after timeout. stdin is left open, see the timed waitAny().
+     * @return The processes that completed in time, in the order they completed.
+     */
+    std::vector<ProcessExit> waitAll(const std::vector<Process *> &processes, std::chrono::milliseconds timeout);
+};
@@ -0,0 +1,443 @@
+#pragma once
+
+#ifdef __linux__
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace cpplib
+{
+    /**
+     * A single-producer single-consumer ring of records in a memfd shared between a process and its child,
+     * for moving bulk data to or from a helper binary without copying it through a pipe (Linux).
+     *
+     * The parent creates the ring and hands it to the child with Process::shareRing(); the child, which only
+     * needs this header, attaches with fromEnvironment(). Writing and reading are lock-free, each record is
+     * copied once into the shared memory and read in place. A side only makes a futex call when the other one
+     * sleeps on an empty (or full) ring, so a busy ring runs without syscalls.
+     *
+     * @code
+     * // parent
+     * cpplib::SharedRing ring = cpplib::SharedRing::create(64 << 20);
+     * proc.shareRing(ring, "RESULTS_RING");
+     * proc.startAsync();
+     * std::string_view record;
+     * while (ring.read(record))
+     *     consume(record);
+     *
+     * // child
+     * cpplib::SharedRing ring = cpplib::SharedRing::fromEnvironment("RESULTS_RING");
+     * ring.write(result);
+     * ring.close();
+     * @endcode
+     */
+    class SharedRing
+    {
+    public:
+        /** Bytes before the data area, holding the positions and wake-up words. */
+        static constexpr size_t headerSize = 4096;
+        /** Bytes taken by each record in addition to its size rounded up to 8. */
+        static constexpr size_t recordOverhead = 8;
+
+        SharedRing() = default;
+
+        ~SharedRing()
+        {
+            reset();
+        }
+
+        SharedRing(const SharedRing &) = delete;
+        SharedRing &operator=(const SharedRing &) = delete;
+
+        SharedRing(SharedRing &&other) noexcept
+        {
+            swap(other);
+        }
+
+        SharedRing &operator=(SharedRing &&other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                swap(other);
+            }
+            return *this;
+        }
+
+        /**
+         * Creates an empty ring in a new memfd (close-on-exec, see Process::shareRing()).
+         * @param capacity Size of the data area, rounded up to a power of two of at least 4096 bytes.
+         */
+        static SharedRing create(size_t capacity)
+        {
+            size_t rounded = 4096;
+            while (rounded < capacity)
+                rounded *= 2;
+
+            int fd = memfd_create("cpplib-ring", MFD_CLOEXEC);
+            if (fd == -1)
+                throw std::runtime_error(std::string("SharedRing: memfd_create() failed: ") + std::strerror(errno));
+            if (ftruncate(fd, headerSize + rounded) == -1)
+            {
+                int error = errno;
+                ::close(fd);
+                throw std::runtime_error(std::string("SharedRing: ftruncate() failed: ") + std::strerror(error));
+            }
+
+            SharedRing ring;
+            ring.map(fd, headerSize + rounded);
+            new (ring.m_header) Header();
+            ring.m_header->magic = Magic;
+            ring.m_header->capacity = rounded;
+            ring.m_mask = rounded - 1;
+            return ring;
+        }
+
+        /** Attaches to a ring created by create() in another process, taking ownership of fd. */
+        static SharedRing attach(int fd)
+        {
+            struct stat st;
+            if (fstat(fd, &st) == -1)
+                throw std::runtime_error(std::string("SharedRing: fstat() failed: ") + std::strerror(errno));
+            if (static_cast<size_t>(st.st_size) <= headerSize)
+                throw std::runtime_error("SharedRing: fd is not a shared ring");
+
+            SharedRing ring;
+            ring.map(fd, st.st_size);
+            uint64_t capacity = ring.m_header->capacity;
+            if (ring.m_header->magic != Magic || capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+                headerSize + capacity != static_cast<size_t>(st.st_size))
+            {
+                ring.m_fd = -1; // the caller keeps an fd that turned out not to be a ring
+                throw std::runtime_error("SharedRing: fd is not a shared ring");
+            }
+            ring.m_mask = capacity - 1;
+            ring.m_cachedTail = ring.m_header->tail.load(std::memory_order_acquire);
+            ring.m_readPos = ring.m_releasedPos = ring.m_cachedTail;
+            ring.m_cachedHead = ring.m_header->head.load(std::memory_order_acquire);
+            return ring;
+        }
+
+        /** Attaches to the ring whose fd number the parent stored in the environment variable name. */
+        static SharedRing fromEnvironment(const char *name)
+        {
+            const char *value = std::getenv(name);
+            if (!value || !*value)
+                throw std::runtime_error(std::string("SharedRing: ") + name + " is not set");
+            char *end;
+            long fd = std::strtol(value, &end, 10);
+            if (*end || fd < 0 || fd > INT32_MAX)
+                throw std::runtime_error(std::string("SharedRing: ") + name + " is not an fd number");
+            return attach(static_cast<int>(fd));
+        }
+
+        bool valid() const
+        {
+            return m_header != nullptr;
+        }
+
+        int fd() const
+        {
+            return m_fd;
+        }
+
+        /** Size of the data area. */
+        size_t capacity() const
+        {
+            return m_header ? m_header->capacity : 0;
+        }
+
+        /** The largest record write() accepts, half the capacity so that a wrapping record always fits. */
+        size_t maxRecordSize() const
+        {
+            return capacity() / 2 - recordOverhead;
+        }
+
+        /**
+         * Appends a record if there is room for it, never blocks (producer side).
+         * @return false if the ring is full or closed.
+         */
+        bool tryWrite(std::string_view record)
+        {
+            if (record.size() > maxRecordSize())
+                throw std::invalid_argument("SharedRing: record larger than maxRecordSize()");
+            if (closed())
+                return false;
+
+            size_t capacity = m_header->capacity;
+            size_t need = recordOverhead + align(record.size());
+            uint64_t head = m_header->head.load(std::memory_order_relaxed);
+            size_t offset = head & m_mask;
+            // Records are contiguous, one that would cross the end starts over at offset 0.
+            size_t skip = capacity - offset < need ? capacity - offset : 0;
+            if (head + skip + need - m_cachedTail > capacity)
+            {
+                m_cachedTail = m_header->tail.load(std::memory_order_acquire);
+                if (head + skip + need - m_cachedTail > capacity)
+                    return false;
+            }
+
+            if (skip)
+            {
+                writeRecordHeader(offset, 0, WrapFlag);
+                offset = 0;
+            }
+            writeRecordHeader(offset, static_cast<uint32_t>(record.size()), 0);
+            std::memcpy(m_data + offset + recordOverhead, record.data(), record.size());
+
+            m_header->head.store(head + skip + need, std::memory_order_seq_cst);
+            if (m_header->readerWaiting.load(std::memory_order_seq_cst))
+                wake(m_header->dataSeq);
+            return true;
+        }
+
+        /**
+         * Appends a record, waiting while the ring is full (producer side).
+         * @return false if the ring was closed.
+         */
+        bool write(std::string_view record)
+        {
+            return writeUntil(record, nullptr);
+        }
+
+        /** Like write(), but gives up after timeout, returns false then. */
+        bool write(std::string_view record, std::chrono::milliseconds timeout)
+        {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            return writeUntil(record, &deadline);
+        }
+
+        /**
+         * Takes the next record if there is one, never blocks (consumer side).
+         * The record is read in place, it stays valid until the next read or release().
+         */
+        bool tryRead(std::string_view &record)
+        {
+            release();
+            for (;;)
+            {
+                if (m_readPos == m_cachedHead)
+                {
+                    m_cachedHead = m_header->head.load(std::memory_order_acquire);
+                    if (m_readPos == m_cachedHead)
+                        return false;
+                }
+
+                size_t offset = m_readPos & m_mask;
+                uint32_t header[2];
+                std::memcpy(header, m_data + offset, sizeof(header));
+                if (header[1] & WrapFlag)
+                {
+                    m_readPos += m_header->capacity - offset;
+                    continue;
+                }
+                if (header[0] > maxRecordSize())
+                    throw std::runtime_error("SharedRing: corrupt record");
+
+                record = std::string_view(m_data + offset + recordOverhead, header[0]);
+                m_readPos += recordOverhead + align(header[0]);
+                return true;
+            }
+        }
+
+        /**
+         * Takes the next record, waiting while the ring is empty (consumer side).
+         * @return false once the ring is closed and drained.
+         */
+        bool read(std::string_view &record)
+        {
+            return readUntil(record, nullptr);
+        }
+
+        /** Like read(), but gives up after timeout, returns false then. */
+        bool read(std::string_view &record, std::chrono::milliseconds timeout)
+        {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            return readUntil(record, &deadline);
+        }
+
+        /** Hands the space of the records read so far back to the producer, done by every read too. */
+        void release()
+        {
+            if (m_releasedPos == m_readPos)
+                return;
+            m_releasedPos = m_readPos;
+            m_header->tail.store(m_readPos, std::memory_order_seq_cst);
+            if (m_header->writerWaiting.load(std::memory_order_seq_cst))
+                wake(m_header->spaceSeq);
+        }
+
+        /**
+         * Marks the ring closed, from either side: the consumer reads what is left and then sees the end,
+         * the producer's writes fail. Wakes both sides.
+         */
+        void close()
+        {
+            m_header->closed.store(1, std::memory_order_seq_cst);
+            wake(m_header->dataSeq);
+            wake(m_header->spaceSeq);
+        }
+
+        bool closed() const
+        {
+            return m_header->closed.load(std::memory_order_acquire) != 0;
+        }
+
+    private:
+        static constexpr uint64_t Magic = 0x676e695262707063ULL; // "cppbRing"
+        static constexpr uint32_t WrapFlag = 1;
+
+        struct Header
+        {
+            uint64_t magic = 0;
+            uint64_t capacity = 0;
+            // Producer line.
+            alignas(64) std::atomic<uint64_t> head{0};
+            std::atomic<uint32_t> readerWaiting{0};
+            std::atomic<uint32_t> dataSeq{0}; // the consumer sleeps on it
+            // Consumer line.
+            alignas(64) std::atomic<uint64_t> tail{0};
+            std::atomic<uint32_t> writerWaiting{0};
+            std::atomic<uint32_t> spaceSeq{0}; // the producer sleeps on it
+            alignas(64) std::atomic<uint32_t> closed{0};
+        };
+        static_assert(sizeof(Header) <= headerSize, "SharedRing header too large");
+        static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+                      "SharedRing needs lock-free atomics in shared memory");
+
+        static size_t align(size_t size)
+        {
+            return (size + 7) & ~size_t(7);
+        }
+
+        void map(int fd, size_t size)
+        {
+            void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (memory == MAP_FAILED)
+                throw std::runtime_error(std::string("SharedRing: mmap() failed: ") + std::strerror(errno));
+            m_fd = fd;
+            m_mapSize = size;
+            m_header = static_cast<Header *>(memory);
+            m_data = static_cast<char *>(memory) + headerSize;
+        }
+
+        void reset()
+        {
+            if (m_header)
+                munmap(m_header, m_mapSize);
+            if (m_fd != -1)
+                ::close(m_fd);
+            m_header = nullptr;
+            m_fd = -1;
+        }
+
+        void swap(SharedRing &other) noexcept
+        {
+            std::swap(m_fd, other.m_fd);
+            std::swap(m_header, other.m_header);
+            std::swap(m_data, other.m_data);
+            std::swap(m_mapSize, other.m_mapSize);
+            std::swap(m_mask, other.m_mask);
+            std::swap(m_cachedTail, other.m_cachedTail);
+            std::swap(m_cachedHead, other.m_cachedHead);
+            std::swap(m_readPos, other.m_readPos);
+            std::swap(m_releasedPos, other.m_releasedPos);
+        }
+
+        void writeRecordHeader(size_t offset, uint32_t size, uint32_t flags)
+        {
+            uint32_t header[2] = {size, flags};
+            std::memcpy(m_data + offset, header, sizeof(header));
+        }
+
+        static void wake(std::atomic<uint32_t> &word)
+        {
+            word.fetch_add(1, std::memory_order_seq_cst);
+            syscall(SYS_futex, &word, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+        }
+
+        /** Sleeps while word still holds value. Returns false without sleeping once deadline has passed. */
+        static bool sleep(std::atomic<uint32_t> &word, uint32_t value, const std::chrono::steady_clock::time_point *deadline)
+        {
+            timespec timeout;
+            timespec *timeoutPtr = nullptr;
+            if (deadline)
+            {
+                auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(*deadline - std::chrono::steady_clock::now());
+                if (left.count() <= 0)
+                    return false;
+                timeout.tv_sec = static_cast<time_t>(left.count() / 1000000000);
+                timeout.tv_nsec = static_cast<long>(left.count() % 1000000000);
+                timeoutPtr = &timeout;
+            }
+            syscall(SYS_futex, &word, FUTEX_WAIT, value, timeoutPtr, nullptr, 0);
+            return true;
+        }
+
+        bool writeUntil(std::string_view record, const std::chrono::steady_clock::time_point *deadline)
+        {
+            for (;;)
+            {
+                if (tryWrite(record))
+                    return true;
+                if (closed())
+                    return false;
+
+                // Announce the sleep, then look again: either we see the new space or the consumer sees us.
+                uint32_t seq = m_header->spaceSeq.load(std::memory_order_seq_cst);
+                m_header->writerWaiting.store(1, std::memory_order_seq_cst);
+                bool changed = m_header->tail.load(std::memory_order_seq_cst) != m_cachedTail || closed();
+                bool inTime = changed || sleep(m_header->spaceSeq, seq, deadline);
+                m_header->writerWaiting.store(0, std::memory_order_relaxed);
+                if (!inTime)
+                    return tryWrite(record);
+            }
+        }
+
+        bool readUntil(std::string_view &record, const std::chrono::steady_clock::time_point *deadline)
+        {
+            for (;;)
+            {
+                if (tryRead(record))
+                    return true;
+                if (closed())
+                    return tryRead(record); // written before the close
+
+                uint32_t seq = m_header->dataSeq.load(std::memory_order_seq_cst);
+                m_header->readerWaiting.store(1, std::memory_order_seq_cst);
+                bool changed = m_header->head.load(std::memory_order_seq_cst) != m_readPos || closed();
+                bool inTime = changed || sleep(m_header->dataSeq, seq, deadline);
+                m_header->readerWaiting.store(0, std::memory_order_relaxed);
+                if (!inTime)
+                    return tryRead(record);
+            }
+        }
+
+        int m_fd = -1;
+        Header *m_header = nullptr;
+        char *m_data = nullptr;
+        size_t m_mapSize = 0;
+        uint64_t m_mask = 0;
+        // Producer state.
+        uint64_t m_cachedTail = 0;
+        // Consumer state: m_readPos is past the last record returned, m_releasedPos what tail was last set to.
+        uint64_t m_cachedHead = 0;
+        uint64_t m_readPos = 0;
+        uint64_t m_releasedPos = 0;
+    };
+};
+#endif
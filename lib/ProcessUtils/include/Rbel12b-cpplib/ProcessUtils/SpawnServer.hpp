@@ -0,0 +1,43 @@
+#pragma once
+#include "ProcessUtils.hpp"
+
+namespace cpplib
+{
+    /**
+     * A small helper process forked early that creates children on behalf of this process
+     * (Linux only). Once the parent has grown large or multithreaded, even vfork-style spawning
+     * has to block signals and stall the calling thread; the helper does it from a tiny,
+     * single-threaded address space instead. Processes opt in with
+     * `setSpawnBackend(SpawnBackend::Server)`.
+     *
+     * The children are created as children of this process (clone(CLONE_PARENT)), so exit
+     * codes, callbacks and waitForExit() work exactly as with the other backends.
+     * Stdio, environment, working directory and process group are taken from this process
+     * on every spawn; other inherited state (umask, resource limits, ignored signals) is the
+     * one this process had when start() was called.
+     *
+     * Spawns through the helper are serialized: it is single-threaded, and each start() holds
+     * one lock for its whole request/reply round trip, up to the child's exec. Concurrent
+     * launches, e.g. from a ProcessPool or ProcessGraph with several free slots, queue behind
+     * each other; the helper lowers the latency of each spawn, not the throughput of many.
+     * Parents that launch from many threads at once and are not large are better served by
+     * SpawnBackend::Vfork, which spawns from each calling thread in parallel.
+     */
+    class SpawnServer
+    {
+    public:
+        /**
+         * Forks the helper. Call it early in main(), while this process is small and before
+         * any thread is created. Does nothing if the helper is already running.
+         * Throws std::runtime_error on failure.
+         */
+        static void start();
+
+        /**
+         * Stops the helper. Children spawned through it are not affected.
+         */
+        static void stop();
+
+        static bool running();
+    };
+};
@@ -0,0 +1,357 @@
+#include "CachedRunner.hpp"
+#include "ProcessCore.hpp"
+#include "Sha256.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include "ChildSpawn.hpp"
+#endif
+
+namespace cpplib
+{
+    namespace
+    {
+        const char entryMagic[8] = {'c', 'p', 'p', 'l', 'i', 'b', 'R', '1'};
+
+        /** Start of every entry file, followed by the output and then the error bytes. */
+        struct EntryHeader
+        {
+            char magic[8];
+            int32_t exitCode;
+            uint32_t reserved;
+            uint64_t outputSize;
+            uint64_t errorSize;
+        };
+
+        /** Marks the files being written, they are renamed to the bare key once complete. */
+        const char tempMarker[] = ".tmp-";
+    }
+
+    CachedRunner::CachedRunner(const std::filesystem::path &directory, uint64_t maxBytes)
+        : m_directory(directory), m_maxBytes(maxBytes)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(m_directory, ec);
+        if (ec)
+            throw std::runtime_error("CachedRunner: cannot create " + m_directory.string() + ": " + ec.message());
+
+        std::random_device random;
+        uint64_t id = (uint64_t(random()) << 32) ^ random();
+        static const char digits[] = "0123456789abcdef";
+        for (int shift = 60; shift >= 0; shift -= 4)
+            m_tempPrefix.push_back(digits[(id >> shift) & 0xf]);
+    }
+
+    void CachedRunner::setKeyEnvironment(std::vector<std::string> names)
+    {
+        m_keyEnvironment = std::move(names);
+    }
+
+    void CachedRunner::setHashExecutableContent(bool hashContent)
+    {
+        m_hashExecutableContent = hashContent;
+    }
+
+    void CachedRunner::setCacheFailures(bool cacheFailures)
+    {
+        m_cacheFailures = cacheFailures;
+    }
+
+    CommunicateResult CachedRunner::run(Process &proc, std::string_view input, bool *cacheHit)
+    {
+        if (cacheHit)
+            *cacheHit = false;
+        std::string entryKey = key(proc, input);
+        if (entryKey.empty())
+            return proc.communicate(input);
+
+        std::filesystem::path path = entryPath(entryKey);
+        CommunicateResult result;
+        if (load(path, result))
+        {
+            if (cacheHit)
+                *cacheHit = true;
+            return result;
+        }
+
+        result = proc.communicate(input);
+        if (result.exitCode == 0 || m_cacheFailures)
+            store(path, result);
+        return result;
+    }
+
+    std::string CachedRunner::key(const Process &proc, std::string_view input)
+    {
+        const detail::ProcessCore &core = *proc.m_core;
+#ifndef _WIN32
+        bool extraFds = !core.m_fdMappings.empty();
+#ifdef __linux__
+        extraFds = extraFds || !core.m_sharedRings.empty();
+#endif
+        if (extraFds)
+            throw std::invalid_argument("CachedRunner: processes with mapped fds or shared rings cannot be cached");
+#endif
+        if (core.m_stdoutRedirect.kind != StreamRedirect::Kind::Pipe ||
+            core.m_stderrRedirect.kind != StreamRedirect::Kind::Pipe ||
+            (core.m_stdinRedirect.kind != StreamRedirect::Kind::Pipe &&
+             core.m_stdinRedirect.kind != StreamRedirect::Kind::Null))
+            throw std::invalid_argument("CachedRunner: stdout and stderr must be pipes and stdin a pipe or /dev/null");
+
+        // The argv and environment the child gets, as Process::start() builds them.
+        std::vector<std::string> argv;
+        std::string executable; // what is executed, argv[0] unless the command was resolved ahead
+        const std::vector<std::string> *environment = &core.m_environment;
+        std::vector<std::string> preparedEnvironment;
+        bool customEnvironment = core.m_hasCustomEnvironment;
+        if (core.m_preparedCommand)
+        {
+            const PreparedCommand &cmd = *core.m_preparedCommand;
+            if (!cmd.prepared() || core.m_slotValues.size() != cmd.slotCount())
+                return {}; // start() reports it
+            for (char *arg : cmd.argv(core.m_slotValues))
+            {
+                if (arg)
+                    argv.emplace_back(arg);
+            }
+            for (char *const *var = cmd.envp(); *var; ++var)
+                preparedEnvironment.emplace_back(*var);
+            environment = &preparedEnvironment;
+            customEnvironment = true;
+            executable = cmd.executable();
+        }
+        else
+        {
+            argv.push_back(core.m_exePath.string());
+            argv.insert(argv.end(), core.m_arguments.begin(), core.m_arguments.end());
+            executable = argv[0];
+        }
+        auto lookup = [&](const std::string &name) -> const char *
+        {
+            if (!customEnvironment)
+                return std::getenv(name.c_str());
+            for (const std::string &variable : *environment)
+            {
+                if (variable.size() > name.size() && variable[name.size()] == '=' &&
+                    variable.compare(0, name.size(), name) == 0)
+                    return variable.c_str() + name.size() + 1;
+            }
+            return nullptr;
+        };
+
+        std::filesystem::path workingDirectory = std::filesystem::current_path();
+        if (!core.m_workingDirectory.empty())
+            workingDirectory = (workingDirectory / core.m_workingDirectory).lexically_normal();
+
+        std::filesystem::path exe = executable;
+#ifndef _WIN32
+        // A custom environment means execve(), which takes the path as is.
+        if (!customEnvironment)
+            exe = detail::resolveExecutable(executable, std::getenv("PATH"));
+#endif
+        if (exe.is_relative())
+            exe = workingDirectory / exe;
+        std::string identity = executableIdentity(exe);
+        if (identity.empty())
+            return {};
+
+        detail::Sha256 hash;
+        hash.updateField("cpplib CachedRunner 1");
+        hash.updateField(identity);
+        hash.updateField(std::to_string(argv.size()));
+        for (const std::string &arg : argv)
+            hash.updateField(arg);
+        hash.updateField(workingDirectory.string());
+        hash.updateField(std::to_string(m_keyEnvironment.size()));
+        for (const std::string &name : m_keyEnvironment)
+        {
+            const char *value = lookup(name);
+            hash.updateField(name);
+            // The '=' tells an empty variable from an unset one.
+            hash.updateField(value ? "=" + std::string(value) : std::string());
+        }
+        hash.updateField(input);
+        return hash.hexDigest();
+    }
+
+    std::string CachedRunner::executableIdentity(const std::filesystem::path &exe)
+    {
+        std::error_code ec;
+        if (!std::filesystem::is_regular_file(exe, ec))
+            return {};
+        uint64_t size = std::filesystem::file_size(exe, ec);
+        if (ec)
+            return {};
+        int64_t modified = std::filesystem::last_write_time(exe, ec).time_since_epoch().count();
+        if (ec)
+            return {};
+
+        std::string path = exe.lexically_normal().string();
+        if (!m_hashExecutableContent)
+            return "path:" + path + '\0' + std::to_string(size) + '\0' + std::to_string(modified);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_executableDigests.find(path);
+            if (it != m_executableDigests.end() && it->second.size == size && it->second.modified == modified)
+                return "sha256:" + it->second.digest;
+        }
+
+        std::ifstream file(exe, std::ios::binary);
+        if (!file)
+            return {};
+        detail::Sha256 hash;
+        std::vector<char> buffer(64 * 1024);
+        while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0)
+            hash.update(buffer.data(), static_cast<size_t>(file.gcount()));
+        if (file.bad())
+            return {};
+        std::string digest = hash.hexDigest();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_executableDigests[path] = {size, modified, digest};
+        return "sha256:" + digest;
+    }
+
+    std::filesystem::path CachedRunner::entryPath(const std::string &key) const
+    {
+        return m_directory / key.substr(0, 2) / key;
+    }
+
+    bool CachedRunner::load(const std::filesystem::path &path, CommunicateResult &result)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+
+        // Sizes are checked against the open file, an entry is never modified once renamed into place.
+        file.seekg(0, std::ios::end);
+        uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+        file.seekg(0);
+        EntryHeader header;
+        if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+            std::memcmp(header.magic, entryMagic, sizeof(entryMagic)) != 0 ||
+            header.outputSize > fileSize || header.errorSize > fileSize ||
+            sizeof(header) + header.outputSize + header.errorSize != fileSize)
+            return false; // cut short by a crash, overwritten by the next store()
+
+        result.exitCode = header.exitCode;
+        result.output.resize(header.outputSize);
+        result.error.resize(header.errorSize);
+        if (!file.read(&result.output[0], result.output.size()) || !file.read(&result.error[0], result.error.size()))
+            return false;
+        file.close();
+
+        // The modification time is the LRU clock.
+        std::error_code ec;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+        return true;
+    }
+
+    void CachedRunner::store(const std::filesystem::path &path, const CommunicateResult &result)
+    {
+        uint64_t size = sizeof(EntryHeader) + result.output.size() + result.error.size();
+        if (size > m_maxBytes)
+            return;
+
+        std::string tempName = path.filename().string() + tempMarker + m_tempPrefix + "-";
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            tempName += std::to_string(++m_tempCounter);
+        }
+        std::filesystem::path temp = path.parent_path() / tempName;
+
+        // Storing is best effort, the result is returned either way.
+        std::error_code ec;
+        std::filesystem::create_directories(path.parent_path(), ec);
+        {
+            EntryHeader header = {};
+            std::memcpy(header.magic, entryMagic, sizeof(entryMagic));
+            header.exitCode = result.exitCode;
+            header.outputSize = result.output.size();
+            header.errorSize = result.error.size();
+
+            std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            file.write(result.output.data(), result.output.size());
+            file.write(result.error.data(), result.error.size());
+            file.close();
+            if (!file)
+            {
+                std::filesystem::remove(temp, ec);
+                return;
+            }
+        }
+        std::filesystem::rename(temp, path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(temp, ec);
+            return;
+        }
+
+        bool trimNow;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_storedSinceTrim += size;
+            trimNow = m_storedSinceTrim > m_maxBytes / 16;
+            if (trimNow)
+                m_storedSinceTrim = 0;
+        }
+        if (trimNow)
+            trim();
+    }
+
+    void CachedRunner::trim()
+    {
+        struct Entry
+        {
+            std::filesystem::file_time_type modified;
+            uint64_t size;
+            std::filesystem::path path;
+        };
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+        // Temporary files this old belong to writers that died.
+        auto abandoned = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+
+        // Other runners may remove files while this one scans, every error just skips the file.
+        std::error_code ec;
+        for (auto it = std::filesystem::recursive_directory_iterator(m_directory, ec);
+             !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+        {
+            std::error_code entryError;
+            if (!it->is_regular_file(entryError))
+                continue;
+            auto modified = it->last_write_time(entryError);
+            uint64_t size = it->file_size(entryError);
+            if (entryError)
+                continue;
+            if (it->path().filename().string().find(tempMarker) != std::string::npos)
+            {
+                if (modified < abandoned)
+                    std::filesystem::remove(it->path(), entryError);
+                continue;
+            }
+            entries.push_back({modified, size, it->path()});
+            total += size;
+        }
+        if (total <= m_maxBytes)
+            return;
+
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+                  { return a.modified < b.modified; });
+        for (const Entry &entry : entries)
+        {
+            if (total <= m_maxBytes)
+                break;
+            // Also counted when another runner removed it first.
+            std::filesystem::remove(entry.path, ec);
+            if (!ec)
+                total -= entry.size;
+        }
+    }
+};
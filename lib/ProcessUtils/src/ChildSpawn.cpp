@@ -0,0 +1,567 @@
+#include "ChildSpawn.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <cerrno>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if __has_include(<linux/close_range.h>)
+#include <linux/close_range.h>
+#endif
+#endif
+
+extern char **environ;
+
+namespace cpplib
+{
+    namespace detail
+    {
+        namespace
+        {
+            bool redirectFd(int from, int to)
+            {
+                if (from == -1)
+                    return true;
+                if (from == to)
+                    return fcntl(to, F_SETFD, 0) != -1; // keep it open across exec
+                return dup2(from, to) != -1;
+            }
+
+            bool keptFd(const ChildSpec &spec, int fd)
+            {
+                if (fd == spec.errorPipe || fd == spec.cgroupProcsFd)
+                    return true;
+                for (size_t i = 0; i < spec.fdMappingCount; ++i)
+                {
+                    if (spec.fdMappings[i].to == fd)
+                        return true;
+                }
+                return false;
+            }
+
+#ifdef __linux__
+            struct LinuxDirent64
+            {
+                uint64_t d_ino;
+                int64_t d_off;
+                unsigned short d_reclen;
+                unsigned char d_type;
+                char d_name[256];
+            };
+#endif
+
+            /**
+             * Closes every fd from 3 up except the mapping targets, without a cost per possible fd number.
+             * close_range(2) marks the gaps close-on-exec, which also keeps the error pipe and the cgroup fd
+             * until exec; the fallbacks skip them explicitly.
+             * Without it the open fds are listed with getdents64 on /proc/self/fd, both async-signal-safe.
+             */
+            void closeOtherFds(const ChildSpec &spec)
+            {
+#if defined(SYS_close_range) && defined(CLOSE_RANGE_CLOEXEC)
+                unsigned int low = 3;
+                bool supported = true;
+                for (size_t i = 0; i < spec.fdMappingCount && supported; ++i)
+                {
+                    unsigned int target = spec.fdMappings[i].to;
+                    if (target > low)
+                        supported = syscall(SYS_close_range, low, target - 1, CLOSE_RANGE_CLOEXEC) == 0;
+                    low = target + 1;
+                }
+                if (supported && syscall(SYS_close_range, low, ~0U, CLOSE_RANGE_CLOEXEC) == 0)
+                    return;
+#endif
+#ifdef __linux__
+                int dir = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (dir != -1)
+                {
+                    alignas(LinuxDirent64) char buffer[4096];
+                    long got;
+                    while ((got = syscall(SYS_getdents64, dir, buffer, sizeof(buffer))) > 0)
+                    {
+                        for (long pos = 0; pos < got;)
+                        {
+                            auto *entry = reinterpret_cast<LinuxDirent64 *>(buffer + pos);
+                            pos += entry->d_reclen;
+                            int fd = 0;
+                            const char *digit = entry->d_name;
+                            for (; *digit >= '0' && *digit <= '9'; ++digit)
+                                fd = fd * 10 + (*digit - '0');
+                            if (*digit == '\0' && digit != entry->d_name && fd >= 3 && fd != dir && !keptFd(spec, fd))
+                                close(fd);
+                        }
+                    }
+                    close(dir);
+                    return;
+                }
+#endif
+                long maxFd = sysconf(_SC_OPEN_MAX);
+                if (maxFd < 0 || maxFd > 65536)
+                    maxFd = 65536;
+                for (int fd = 3; fd < maxFd; ++fd)
+                {
+                    if (!keptFd(spec, fd))
+                        close(fd);
+                }
+            }
+
+            [[noreturn]] void failChild(const ChildSpec &spec, int stage)
+            {
+                ChildError err{stage, errno};
+                if (spec.errorPipe != -1)
+                {
+                    ssize_t written;
+                    do
+                        written = ::write(spec.errorPipe, &err, sizeof(err));
+                    while (written == -1 && errno == EINTR);
+                }
+                _exit(127);
+            }
+
+            bool hasLimits(const ChildSpec &spec)
+            {
+                return spec.limits.setNice || spec.limits.schedulingPolicy != -1 || spec.limits.ioPriority != -1 ||
+                       spec.limits.cpuCount || spec.limits.resourceLimitCount || spec.cgroupProcsFd != -1;
+            }
+
+            /** Cgroup, affinity, scheduling and resource limits, set on the child itself just before exec. */
+            void applyLimits(const ChildSpec &spec)
+            {
+#ifdef __linux__
+                if (spec.cgroupProcsFd != -1)
+                {
+                    // "0" moves the writing process.
+                    ssize_t written;
+                    do
+                        written = ::write(spec.cgroupProcsFd, "0", 1);
+                    while (written == -1 && errno == EINTR);
+                    if (written != 1)
+                        failChild(spec, STAGE_CGROUP);
+                }
+                if (spec.limits.cpuCount)
+                {
+                    cpu_set_t cpus;
+                    CPU_ZERO(&cpus);
+                    for (uint32_t i = 0; i < spec.limits.cpuCount; ++i)
+                        CPU_SET(spec.cpus[i], &cpus);
+                    if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1)
+                        failChild(spec, STAGE_SCHEDULING);
+                }
+                if (spec.limits.schedulingPolicy != -1)
+                {
+                    sched_param param{};
+                    if (sched_setscheduler(0, spec.limits.schedulingPolicy, &param) == -1)
+                        failChild(spec, STAGE_SCHEDULING);
+                }
+                if (spec.limits.ioPriority != -1 &&
+                    syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, spec.limits.ioPriority) == -1)
+                    failChild(spec, STAGE_SCHEDULING);
+#endif
+                if (spec.limits.setNice && setpriority(PRIO_PROCESS, 0, spec.limits.nice) == -1)
+                    failChild(spec, STAGE_SCHEDULING);
+
+                for (uint32_t i = 0; i < spec.limits.resourceLimitCount; ++i)
+                {
+                    const ResourceLimit &limit = spec.resourceLimits[i];
+                    rlimit value;
+                    value.rlim_cur = limit.soft == ResourceLimit::unlimited ? RLIM_INFINITY : static_cast<rlim_t>(limit.soft);
+                    value.rlim_max = limit.hard == ResourceLimit::unlimited ? RLIM_INFINITY : static_cast<rlim_t>(limit.hard);
+                    if (setrlimit(limit.resource, &value) == -1)
+                        failChild(spec, STAGE_RESOURCE_LIMIT);
+                }
+            }
+
+            /**
+             * Runs in the child after fork/clone. Must stay async-signal-safe:
+             * with the Vfork backend it shares the parent's memory.
+             */
+            [[noreturn]] void execChild(const ChildSpec &spec)
+            {
+                if (spec.newSession)
+                    setsid();
+                else if (spec.processGroup != -1)
+                    setpgid(0, spec.processGroup);
+
+                if (!redirectFd(spec.stdinFd, STDIN_FILENO) ||
+                    !redirectFd(spec.stdoutFd, STDOUT_FILENO) ||
+                    !redirectFd(spec.stderrFd, STDERR_FILENO))
+                    failChild(spec, STAGE_REDIRECT);
+                for (size_t i = 0; i < spec.fdMappingCount; ++i)
+                {
+                    if (!redirectFd(spec.fdMappings[i].from, spec.fdMappings[i].to))
+                        failChild(spec, STAGE_REDIRECT);
+                }
+                if (spec.closeOtherFds)
+                    closeOtherFds(spec);
+
+                if (spec.workingDirectory && chdir(spec.workingDirectory) == -1)
+                    failChild(spec, STAGE_CHDIR);
+
+                if (hasLimits(spec))
+                    applyLimits(spec);
+
+                const char *file = spec.executable ? spec.executable : spec.argv[0];
+                if (spec.customEnvironment)
+                    execve(file, spec.argv, spec.envp);
+#ifdef __linux__
+                else if (spec.envp)
+                    execvpe(file, spec.argv, spec.envp);
+#endif
+                else
+                    execvp(file, spec.argv);
+
+                failChild(spec, STAGE_EXEC);
+            }
+
+#ifdef __linux__
+            struct VforkArgs
+            {
+                const ChildSpec *spec;
+                const sigset_t *mask;
+            };
+
+            int vforkChildEntry(void *arg)
+            {
+                auto *args = static_cast<VforkArgs *>(arg);
+
+                // Handlers installed by the parent must not run on the shared address space.
+                for (int sig = 1; sig < NSIG; ++sig)
+                {
+                    struct sigaction sa;
+                    if (sigaction(sig, nullptr, &sa) == 0 &&
+                        sa.sa_handler != SIG_IGN && sa.sa_handler != SIG_DFL)
+                    {
+                        sa.sa_handler = SIG_DFL;
+                        sa.sa_flags = 0;
+                        sigaction(sig, &sa, nullptr);
+                    }
+                }
+                pthread_sigmask(SIG_SETMASK, args->mask, nullptr);
+
+                execChild(*args->spec);
+            }
+
+            pid_t spawnVfork(const ChildSpec &spec)
+            {
+                static const size_t stackSize = 256 * 1024;
+                void *stack = mmap(nullptr, stackSize, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+                if (stack == MAP_FAILED)
+                    return -1;
+
+                // Block every signal so that no handler runs in the child before it resets them.
+                sigset_t all, old;
+                sigfillset(&all);
+                pthread_sigmask(SIG_SETMASK, &all, &old);
+                int cancelState;
+                pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelState);
+
+                int flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+                if (spec.cloneParent)
+                    flags |= CLONE_PARENT;
+
+                VforkArgs args{&spec, &old};
+                pid_t pid = clone(vforkChildEntry, static_cast<char *>(stack) + stackSize, flags, &args);
+                int cloneErrno = errno;
+
+                pthread_setcancelstate(cancelState, nullptr);
+                pthread_sigmask(SIG_SETMASK, &old, nullptr);
+                munmap(stack, stackSize);
+
+                errno = cloneErrno;
+                return pid;
+            }
+#endif
+
+            pid_t spawnPosixSpawn(const ChildSpec &spec)
+            {
+                posix_spawn_file_actions_t actions;
+                posix_spawnattr_t attr;
+                posix_spawn_file_actions_init(&actions);
+                posix_spawnattr_init(&attr);
+
+                if (spec.stdinFd != -1)
+                    posix_spawn_file_actions_adddup2(&actions, spec.stdinFd, STDIN_FILENO);
+                if (spec.stdoutFd != -1)
+                    posix_spawn_file_actions_adddup2(&actions, spec.stdoutFd, STDOUT_FILENO);
+                if (spec.stderrFd != -1)
+                    posix_spawn_file_actions_adddup2(&actions, spec.stderrFd, STDERR_FILENO);
+                // Since glibc 2.29 dup2 onto the same fd clears close-on-exec, see posixSpawnSupports().
+                for (size_t i = 0; i < spec.fdMappingCount; ++i)
+                    posix_spawn_file_actions_adddup2(&actions, spec.fdMappings[i].from, spec.fdMappings[i].to);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 34)
+                if (spec.closeOtherFds)
+                    posix_spawn_file_actions_addclosefrom_np(&actions, static_cast<int>(3 + spec.fdMappingCount));
+#endif
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 29)
+                if (spec.workingDirectory)
+                    posix_spawn_file_actions_addchdir_np(&actions, spec.workingDirectory);
+#endif
+
+                short flags = 0;
+#ifdef POSIX_SPAWN_SETSID
+                if (spec.newSession)
+                    flags |= POSIX_SPAWN_SETSID;
+#endif
+                if (!spec.newSession && spec.processGroup != -1)
+                {
+                    flags |= POSIX_SPAWN_SETPGROUP;
+                    posix_spawnattr_setpgroup(&attr, spec.processGroup);
+                }
+                posix_spawnattr_setflags(&attr, flags);
+
+                pid_t pid = -1;
+                const char *file = spec.executable ? spec.executable : spec.argv[0];
+                int result = spec.customEnvironment
+                                 ? posix_spawn(&pid, file, &actions, &attr, spec.argv, spec.envp)
+                                 : posix_spawnp(&pid, file, &actions, &attr, spec.argv, spec.envp ? spec.envp : environ);
+
+                posix_spawnattr_destroy(&attr);
+                posix_spawn_file_actions_destroy(&actions);
+
+                if (result != 0)
+                {
+                    errno = result;
+                    return -1;
+                }
+                return pid;
+            }
+
+            /** Returns true if posix_spawn can express everything in spec on this C library. */
+            bool posixSpawnSupports(const ChildSpec &spec)
+            {
+#if !defined(__GLIBC__) || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 29)
+                if (spec.workingDirectory || spec.fdMappingCount)
+                    return false;
+#endif
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 34)
+                // closefrom can only keep the targets if they are 3, 4, 5...
+                for (size_t i = 0; spec.closeOtherFds && i < spec.fdMappingCount; ++i)
+                {
+                    if (spec.fdMappings[i].to != static_cast<int>(3 + i))
+                        return false;
+                }
+#else
+                if (spec.closeOtherFds)
+                    return false;
+#endif
+#ifndef POSIX_SPAWN_SETSID
+                if (spec.newSession)
+                    return false;
+#endif
+                return !spec.cloneParent && !hasLimits(spec);
+            }
+        }
+
+        std::string resolveExecutable(const std::string &exe, const char *path)
+        {
+            if (exe.empty() || exe.find('/') != std::string::npos)
+                return exe;
+
+            std::string defaultPath;
+            if (!path)
+            {
+                // What execvp() searches without PATH.
+                defaultPath.resize(confstr(_CS_PATH, nullptr, 0));
+                if (!defaultPath.empty())
+                    confstr(_CS_PATH, &defaultPath[0], defaultPath.size());
+                defaultPath.resize(std::strlen(defaultPath.c_str()));
+                path = defaultPath.c_str();
+            }
+
+            std::string_view dirs = path;
+            size_t begin = 0;
+            while (begin <= dirs.size())
+            {
+                size_t end = dirs.find(':', begin);
+                if (end == std::string_view::npos)
+                    end = dirs.size();
+                // An empty entry means the current directory.
+                std::string dir = end > begin ? std::string(dirs.substr(begin, end - begin)) : ".";
+                std::string candidate = dir + "/" + exe;
+                struct stat st;
+                if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(candidate.c_str(), X_OK) == 0)
+                    return candidate;
+                begin = end + 1;
+            }
+            return exe;
+        }
+
+        int makePipe(int fds[2])
+        {
+#ifdef __linux__
+            return pipe2(fds, O_CLOEXEC);
+#else
+            if (pipe(fds) == -1)
+                return -1;
+            fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+            fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+            return 0;
+#endif
+        }
+
+        void liftFdMappings(std::vector<FdMapping> &mappings, const std::vector<int> &avoid, std::vector<int> &lifted)
+        {
+            std::sort(mappings.begin(), mappings.end(), [](const FdMapping &a, const FdMapping &b)
+                      { return a.to < b.to; });
+
+            int above = 2;
+            for (size_t i = 0; i < mappings.size(); ++i)
+            {
+                if (mappings[i].to < 3)
+                    throw std::invalid_argument("Process::start(): fds 0-2 are mapped with the stream redirects");
+                if (i > 0 && mappings[i].to == mappings[i - 1].to)
+                    throw std::invalid_argument("Process::start(): fd " + std::to_string(mappings[i].to) + " is mapped twice");
+                above = std::max(above, mappings[i].to);
+            }
+            for (int fd : avoid)
+                above = std::max(above, fd);
+
+            for (FdMapping &mapping : mappings)
+            {
+                if (mapping.from == mapping.to)
+                    continue;
+                int fd = fcntl(mapping.from, F_DUPFD_CLOEXEC, above + 1);
+                if (fd == -1)
+                    throw std::runtime_error("Process::start(): fd " + std::to_string(mapping.from) + " cannot be mapped: " + std::strerror(errno));
+                lifted.push_back(fd);
+                mapping.from = fd;
+            }
+        }
+
+        int liftAboveTargets(int fd, const std::vector<FdMapping> &mappings, std::vector<int> &lifted)
+        {
+            int above = 2;
+            bool collides = false;
+            for (const FdMapping &mapping : mappings)
+            {
+                above = std::max(above, mapping.to);
+                collides = collides || mapping.to == fd;
+            }
+            if (!collides)
+                return fd;
+            int lift = fcntl(fd, F_DUPFD_CLOEXEC, above + 1);
+            if (lift == -1)
+                throw std::runtime_error(std::string("Process::start(): fd cannot be moved above the mappings: ") + std::strerror(errno));
+            lifted.push_back(lift);
+            return lift;
+        }
+
+        std::string describeChildError(const ChildError &err)
+        {
+            const char *what = "exec";
+            if (err.stage == STAGE_REDIRECT)
+                what = "redirecting standard streams";
+            else if (err.stage == STAGE_CHDIR)
+                what = "changing working directory";
+            else if (err.stage == STAGE_CGROUP)
+                what = "joining the cgroup";
+            else if (err.stage == STAGE_SCHEDULING)
+                what = "setting the scheduling parameters";
+            else if (err.stage == STAGE_RESOURCE_LIMIT)
+                what = "setting the resource limits";
+            return std::string("Process::start(): ") + what + " failed: " + std::strerror(err.error);
+        }
+
+        pid_t startChild(ChildSpec spec, SpawnBackend backend, ChildError &err)
+        {
+            err = ChildError{0, 0};
+
+            int errorPipe[2];
+            if (makePipe(errorPipe) == -1)
+                return -1;
+            if (spec.fdMappingCount && errorPipe[1] <= spec.fdMappings[spec.fdMappingCount - 1].to)
+            {
+                // A mapping would replace it in the child, move it above the targets.
+                int moved = fcntl(errorPipe[1], F_DUPFD_CLOEXEC, spec.fdMappings[spec.fdMappingCount - 1].to + 1);
+                close(errorPipe[1]);
+                if (moved == -1)
+                {
+                    close(errorPipe[0]);
+                    return -1;
+                }
+                errorPipe[1] = moved;
+            }
+            spec.errorPipe = errorPipe[1];
+
+            pid_t pid;
+#ifdef __linux__
+            if (backend == SpawnBackend::Vfork || spec.cloneParent)
+                pid = spawnVfork(spec);
+            else
+#endif
+            {
+                pid = fork();
+                if (pid == 0)
+                    execChild(spec);
+            }
+            int spawnErrno = errno;
+            close(errorPipe[1]);
+
+            if (pid == -1)
+            {
+                close(errorPipe[0]);
+                errno = spawnErrno;
+                return -1;
+            }
+
+            // EOF means exec succeeded and closed the CLOEXEC write end.
+            ssize_t got;
+            do
+                got = ::read(errorPipe[0], &err, sizeof(err));
+            while (got == -1 && errno == EINTR);
+            close(errorPipe[0]);
+
+            if (got != sizeof(err))
+                err = ChildError{0, 0};
+            return pid;
+        }
+
+        pid_t spawnChild(ChildSpec spec, SpawnBackend backend)
+        {
+            if (backend == SpawnBackend::Server && spec.fdMappingCount > maxServerFdMappings)
+                backend = SpawnBackend::Vfork;
+            if (backend == SpawnBackend::Server)
+                return spawnThroughServer(spec);
+
+            if (backend == SpawnBackend::PosixSpawn && !posixSpawnSupports(spec))
+                backend = SpawnBackend::Vfork;
+
+            if (backend == SpawnBackend::PosixSpawn)
+            {
+                // The C library already reports exec failures through posix_spawn's return value.
+                pid_t pid = spawnPosixSpawn(spec);
+                if (pid == -1)
+                    throw std::runtime_error(std::string("Process::start(): posix_spawn failed: ") + std::strerror(errno));
+                return pid;
+            }
+
+            ChildError err;
+            pid_t pid = startChild(spec, backend, err);
+            if (pid == -1)
+                throw std::runtime_error(std::string("Process::start(): fork failed: ") + std::strerror(errno));
+
+            if (err.stage != 0)
+            {
+                int status;
+                while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+                    ;
+                throw std::runtime_error(describeChildError(err));
+            }
+            return pid;
+        }
+    };
+};
+#endif
@@ -0,0 +1,123 @@
+#pragma once
+#include "ProcessUtils.hpp"
+
+#ifndef _WIN32
+#include <sys/types.h>
+
+namespace cpplib
+{
+    namespace detail
+    {
+        /** A parent fd given to the child as another fd number. */
+        struct FdMapping
+        {
+            int from;
+            int to;
+        };
+
+        /** Scheduling and resources of the child, plain data so it is sent to the SpawnServer as is. */
+        struct ChildLimits
+        {
+            int32_t setNice = 0;
+            int32_t nice = 0;
+            int32_t schedulingPolicy = -1; // SCHED_BATCH or SCHED_IDLE, -1 to keep the parent's
+            int32_t ioPriority = -1;       // ioprio_set() value, -1 to keep the parent's
+            uint32_t cpuCount = 0;
+            uint32_t resourceLimitCount = 0;
+        };
+
+        /**
+         * Everything the child needs between spawn and exec, prepared by the parent
+         * so the child side only has to make async-signal-safe calls.
+         */
+        struct ChildSpec
+        {
+            char *const *argv = nullptr;
+            const char *executable = nullptr; // executed instead of argv[0] when set, e.g. a path resolved ahead
+            // With customEnvironment the executable is not searched on PATH, like execve(). Without it the child
+            // gets envp if set (Linux) and this process's environment otherwise.
+            char *const *envp = nullptr;
+            bool customEnvironment = false;
+            const char *workingDirectory = nullptr;
+            bool newSession = false;
+            pid_t processGroup = -1; // joined by the child with setpgid(), -1 to keep the parent's
+            int stdinFd = -1;
+            int stdoutFd = -1;
+            int stderrFd = -1;
+            // dup2'd after the standard streams, sorted by target. Sources other than the target itself
+            // must not collide with any target or stream fd, see liftFdMappings().
+            const FdMapping *fdMappings = nullptr;
+            size_t fdMappingCount = 0;
+            bool closeOtherFds = false; // everything from 3 up except the mapping targets is closed at exec
+            // Applied before exec, Linux only except the nice value and the resource limits.
+            ChildLimits limits;
+            const int *cpus = nullptr;                     // limits.cpuCount CPUs of the affinity mask
+            const ResourceLimit *resourceLimits = nullptr; // limits.resourceLimitCount limits
+            int cgroupProcsFd = -1;                        // cgroup.procs of the cgroup v2 to join
+            int errorPipe = -1;
+            bool cloneParent = false; // Linux, Vfork backend: the child is created as a sibling of the caller
+        };
+
+        /** Written to the error pipe by the child when it fails before exec completes. */
+        struct ChildError
+        {
+            int stage;
+            int error;
+        };
+
+        enum ChildStage
+        {
+            STAGE_REDIRECT = 1,
+            STAGE_CHDIR,
+            STAGE_EXEC,
+            STAGE_CGROUP,
+            STAGE_SCHEDULING,
+            STAGE_RESOURCE_LIMIT,
+        };
+
+        /**
+         * Looks up exe in the directories of path like execvp() does, returns exe unchanged if not found.
+         * @param path A PATH value, nullptr for the default search path execvp() uses without PATH.
+         */
+        std::string resolveExecutable(const std::string &exe, const char *path);
+
+        /** pipe() with both ends close-on-exec. */
+        int makePipe(int fds[2]);
+
+        /**
+         * Checks mappings (targets 3 or above, each used once), sorts them by target and replaces every source
+         * that is not its own target by a close-on-exec duplicate above all targets and all of avoid, so the
+         * child can apply them in order without overwriting a source. The duplicates are added to lifted,
+         * for the caller to close once the child is spawned. Throws std::invalid_argument or std::runtime_error.
+         */
+        void liftFdMappings(std::vector<FdMapping> &mappings, const std::vector<int> &avoid, std::vector<int> &lifted);
+
+        /**
+         * Returns fd, or a close-on-exec duplicate above all targets (added to lifted) if fd is the target of
+         * one of mappings, which the child's dup2() would overwrite. Throws std::runtime_error.
+         */
+        int liftAboveTargets(int fd, const std::vector<FdMapping> &mappings, std::vector<int> &lifted);
+
+        std::string describeChildError(const ChildError &err);
+
+        /**
+         * Creates the child with the Fork or Vfork backend and waits until it has either
+         * exec'd or failed. On failure err.stage is set and the child is left for the caller to reap.
+         * @return The child's pid, -1 with errno set if no child could be created.
+         */
+        pid_t startChild(ChildSpec spec, SpawnBackend backend, ChildError &err);
+
+        /**
+         * Creates the child with the requested backend and waits until it has either
+         * exec'd or failed, throwing std::runtime_error in the latter case.
+         */
+        pid_t spawnChild(ChildSpec spec, SpawnBackend backend);
+
+        /** Mappings a request to the SpawnServer can carry, spawnChild() uses Vfork beyond that. */
+        const size_t maxServerFdMappings = 64;
+
+        /** Sends spec to the running SpawnServer, see SpawnServer.cpp. */
+        pid_t spawnThroughServer(const ChildSpec &spec);
+    };
+};
+#endif
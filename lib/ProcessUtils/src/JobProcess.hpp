@@ -0,0 +1,56 @@
+#pragma once
+#include "ProcessPool.hpp"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace cpplib
+{
+    namespace detail
+    {
+        /**
+         * Starts the process of a ProcessPool job or ProcessGraph node.
+         * The process is given reactor and added to running under mutex before start(), because its exit
+         * callback, which calls onExit, may run before start() returns.
+         * A failed start() is returned instead of reported through onExit, with the process left in running:
+         * the caller records it and lets its fill loop start the next job. Starting that job from the failure
+         * path recursed once per failing job.
+         * @return The start() error, std::nullopt once the process is running.
+         */
+        template <typename Id>
+        std::optional<std::string> startJobProcess(Id id, ProcessJob job, std::mutex &mutex, ProcessReactor *const &reactor,
+                                                   std::unordered_map<Id, std::unique_ptr<Process>> &running,
+                                                   std::function<void(int exitCode)> onExit)
+        {
+            auto proc = std::make_unique<Process>();
+            proc->setCommand(job.command);
+            proc->appendArguments(job.arguments);
+            if (!job.environment.empty())
+                proc->setEnvironment(job.environment);
+            proc->setWorkingDirectory(job.workingDirectory);
+            proc->setOutputCallback(std::move(job.outputCallback));
+            proc->setErrorCallback(std::move(job.errorCallback));
+            proc->setExitCallback(std::move(onExit));
+
+            Process *raw = proc.get();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                proc->setReactor(reactor);
+                running.emplace(id, std::move(proc));
+            }
+
+            try
+            {
+                raw->start();
+            }
+            catch (const std::exception &e)
+            {
+                return std::string(e.what());
+            }
+            return std::nullopt;
+        }
+    }
+};
@@ -0,0 +1,83 @@
+#include "OutputTail.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace cpplib
+{
+    void OutputTail::reset(size_t maxBytes, size_t maxLines)
+    {
+        m_data.assign(maxBytes, 0);
+        m_data.shrink_to_fit();
+        m_total = 0;
+        m_maxLines = maxBytes ? maxLines : 0;
+        m_lineEnds.assign(m_maxLines ? m_maxLines + 1 : 0, 0);
+        m_newlines = 0;
+    }
+
+    void OutputTail::append(std::string_view chunk)
+    {
+        size_t capacity = m_data.size();
+        if (capacity == 0 || chunk.empty())
+            return;
+
+        if (m_maxLines)
+        {
+            const char *begin = chunk.data();
+            const char *end = begin + chunk.size();
+            for (const char *p = begin; (p = static_cast<const char *>(std::memchr(p, '\n', end - p))) != nullptr; ++p)
+                m_lineEnds[m_newlines++ % m_lineEnds.size()] = m_total + (p - begin) + 1;
+        }
+
+        // Only the last capacity bytes of the chunk can survive.
+        uint64_t offset = m_total;
+        if (chunk.size() > capacity)
+        {
+            offset += chunk.size() - capacity;
+            chunk.remove_prefix(chunk.size() - capacity);
+        }
+        size_t pos = offset % capacity;
+        size_t first = std::min(chunk.size(), capacity - pos);
+        std::memcpy(m_data.data() + pos, chunk.data(), first);
+        std::memcpy(m_data.data(), chunk.data() + first, chunk.size() - first);
+        m_total = offset + chunk.size();
+    }
+
+    uint64_t OutputTail::start() const
+    {
+        uint64_t start = m_total - std::min<uint64_t>(m_total, m_data.size());
+        if (m_maxLines && m_total > 0)
+        {
+            // The tail begins after the newline that precedes the first kept line.
+            bool unterminated = m_data[(m_total - 1) % m_data.size()] != '\n';
+            uint64_t back = unterminated ? m_maxLines : m_maxLines + 1;
+            if (m_newlines >= back)
+                start = std::max(start, m_lineEnds[(m_newlines - back) % m_lineEnds.size()]);
+        }
+        return start;
+    }
+
+    size_t OutputTail::size() const
+    {
+        return static_cast<size_t>(m_total - start());
+    }
+
+    std::pair<std::string_view, std::string_view> OutputTail::segments() const
+    {
+        uint64_t from = start();
+        size_t length = static_cast<size_t>(m_total - from);
+        if (length == 0)
+            return {};
+        size_t pos = from % m_data.size();
+        size_t first = std::min(length, m_data.size() - pos);
+        return {std::string_view(m_data.data() + pos, first), std::string_view(m_data.data(), length - first)};
+    }
+
+    std::string OutputTail::str() const
+    {
+        auto parts = segments();
+        std::string result;
+        result.reserve(parts.first.size() + parts.second.size());
+        result.append(parts.first).append(parts.second);
+        return result;
+    }
+}; // namespace cpplib
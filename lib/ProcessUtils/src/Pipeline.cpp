@@ -0,0 +1,119 @@
+#include "Pipeline.hpp"
+#include <stdexcept>
+
+#ifndef _WIN32
+#include "ChildSpawn.hpp"
+#include <unistd.h>
+#endif
+
+namespace cpplib
+{
+    Pipeline::~Pipeline()
+    {
+        if (m_startedStages > 0)
+            waitForExit();
+    }
+
+    Process &Pipeline::addStage(const std::filesystem::path &exePath, const std::vector<std::string> &arguments)
+    {
+        if (m_startedStages > 0)
+            throw std::runtime_error("Pipeline already started");
+        auto proc = std::make_unique<Process>();
+        proc->setCommand(exePath);
+        proc->appendArguments(arguments);
+        m_stages.push_back(std::move(proc));
+        return *m_stages.back();
+    }
+
+#ifdef _WIN32
+    int Pipeline::start()
+    {
+        throw std::runtime_error("Pipeline is not supported on Windows");
+        return -1;
+    }
+#else
+    int Pipeline::start()
+    {
+        if (m_stages.empty())
+            throw std::runtime_error("Pipeline has no stages");
+        if (m_startedStages > 0)
+            throw std::runtime_error("Pipeline already started");
+
+        // readEnd is the previous stage's stdout, consumed by the next stage.
+        int readEnd = -1;
+        for (size_t i = 0; i < m_stages.size(); ++i)
+        {
+            Process &proc = *m_stages[i];
+            int link[2] = {-1, -1};
+            bool lastStage = i + 1 == m_stages.size();
+
+            if (!lastStage)
+            {
+                if (detail::makePipe(link) == -1)
+                {
+                    if (readEnd != -1)
+                        close(readEnd);
+                    throw std::runtime_error("pipe() failed");
+                }
+            }
+
+            StreamRedirect stdinRedirect = proc.getStdinRedirect();
+            StreamRedirect stdoutRedirect = proc.getStdoutRedirect();
+            if (readEnd != -1)
+                proc.setStdinRedirect(StreamRedirect::fromFd(readEnd));
+            if (!lastStage)
+                proc.setStdoutRedirect(StreamRedirect::fromFd(link[1]));
+            else if (!m_captureOutput)
+                proc.setStdoutRedirect(StreamRedirect::inherit());
+
+            try
+            {
+                proc.start();
+            }
+            catch (...)
+            {
+                if (readEnd != -1)
+                    close(readEnd);
+                if (link[0] != -1)
+                {
+                    close(link[0]);
+                    close(link[1]);
+                }
+                proc.setStdinRedirect(stdinRedirect);
+                proc.setStdoutRedirect(stdoutRedirect);
+                // Stages already started see EOF/EPIPE and are waited for by the destructor.
+                throw;
+            }
+
+            // Only the children keep the pipe ends between stages open.
+            if (readEnd != -1)
+                close(readEnd);
+            if (link[1] != -1)
+                close(link[1]);
+            proc.setStdinRedirect(stdinRedirect);
+            proc.setStdoutRedirect(stdoutRedirect);
+            readEnd = link[0];
+            ++m_startedStages;
+        }
+
+        return 0;
+    }
+#endif
+
+    std::vector<int> Pipeline::waitForExit()
+    {
+        std::vector<int> exitCodes;
+
+        // In stage order: each exit closes the input of the next stage.
+        for (size_t i = 0; i < m_startedStages; ++i)
+            exitCodes.push_back(m_stages[i]->waitForExit());
+        m_startedStages = 0;
+        return exitCodes;
+    }
+
+    std::vector<int> Pipeline::run()
+    {
+        start();
+        return waitForExit();
+    }
+};
@@ -0,0 +1,167 @@
+#include "PreparedCommand.hpp"
+#include "ChildSpawn.hpp"
+#include <cstring>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <stdlib.h>
+#define environ _environ
+#else
+#include <unistd.h>
+extern char **environ;
+#endif
+
+namespace cpplib
+{
+    PreparedCommand::PreparedCommand(const std::filesystem::path &exePath)
+        : m_exePath(exePath)
+    {
+    }
+
+    PreparedCommand &PreparedCommand::appendArgument(const std::string &arg)
+    {
+        m_arguments.push_back(arg);
+        m_prepared = false;
+        return *this;
+    }
+
+    PreparedCommand &PreparedCommand::appendArguments(const std::vector<std::string> &args)
+    {
+        m_arguments.insert(m_arguments.end(), args.begin(), args.end());
+        m_prepared = false;
+        return *this;
+    }
+
+    size_t PreparedCommand::appendSlot()
+    {
+        m_arguments.emplace_back();
+        m_slots.push_back(m_arguments.size()); // argv index, argv[0] is the executable
+        m_prepared = false;
+        return m_slots.size() - 1;
+    }
+
+    PreparedCommand &PreparedCommand::setEnvironmentVariable(const std::string &name, const std::string &value)
+    {
+        for (Variable &variable : m_overrides)
+        {
+            if (variable.name == name)
+            {
+                variable = {name, value, false};
+                m_prepared = false;
+                return *this;
+            }
+        }
+        m_overrides.push_back({name, value, false});
+        m_prepared = false;
+        return *this;
+    }
+
+    PreparedCommand &PreparedCommand::unsetEnvironmentVariable(const std::string &name)
+    {
+        for (Variable &variable : m_overrides)
+        {
+            if (variable.name == name)
+            {
+                variable = {name, {}, true};
+                m_prepared = false;
+                return *this;
+            }
+        }
+        m_overrides.push_back({name, {}, true});
+        m_prepared = false;
+        return *this;
+    }
+
+    PreparedCommand &PreparedCommand::clearEnvironment()
+    {
+        m_inheritEnvironment = false;
+        m_prepared = false;
+        return *this;
+    }
+
+    void PreparedCommand::prepare()
+    {
+        // The environment first, PATH may come from it.
+        std::vector<std::string> environment;
+        std::vector<bool> applied(m_overrides.size(), false);
+        if (m_inheritEnvironment && environ)
+        {
+            for (char **entry = environ; *entry; ++entry)
+            {
+                const char *equals = std::strchr(*entry, '=');
+                size_t nameLength = equals ? equals - *entry : std::strlen(*entry);
+
+                size_t i = 0;
+                while (i < m_overrides.size() &&
+                       (m_overrides[i].name.size() != nameLength || m_overrides[i].name.compare(0, nameLength, *entry, nameLength) != 0))
+                    ++i;
+                if (i == m_overrides.size())
+                {
+                    environment.emplace_back(*entry);
+                    continue;
+                }
+                if (!m_overrides[i].unset)
+                    environment.push_back(m_overrides[i].name + "=" + m_overrides[i].value);
+                applied[i] = true;
+            }
+        }
+        for (size_t i = 0; i < m_overrides.size(); ++i)
+        {
+            if (!applied[i] && !m_overrides[i].unset)
+                environment.push_back(m_overrides[i].name + "=" + m_overrides[i].value);
+        }
+
+#ifdef _WIN32
+        m_executable = m_exePath.string();
+#else
+        const char *path = nullptr;
+        for (const std::string &variable : environment)
+        {
+            if (variable.compare(0, 5, "PATH=") == 0)
+                path = variable.c_str() + 5;
+        }
+        m_executable = detail::resolveExecutable(m_exePath.string(), path);
+#endif
+
+        // argv[0] keeps the name as given, like execvp(): multi-call tools look at it.
+        std::string name = m_exePath.string();
+        size_t size = name.size() + 1;
+        for (const std::string &arg : m_arguments)
+            size += arg.size() + 1;
+        for (const std::string &variable : environment)
+            size += variable.size() + 1;
+
+        m_storage.assign(size, '\0');
+        char *next = m_storage.data();
+        auto store = [&next](const std::string &value)
+        {
+            char *stored = next;
+            std::memcpy(stored, value.c_str(), value.size() + 1);
+            next += value.size() + 1;
+            return stored;
+        };
+
+        m_argv.clear();
+        m_argv.reserve(m_arguments.size() + 2);
+        m_argv.push_back(store(name));
+        for (const std::string &arg : m_arguments)
+            m_argv.push_back(store(arg));
+        m_argv.push_back(nullptr);
+
+        m_envp.clear();
+        m_envp.reserve(environment.size() + 1);
+        for (const std::string &variable : environment)
+            m_envp.push_back(store(variable));
+        m_envp.push_back(nullptr);
+
+        m_prepared = true;
+    }
+
+    std::vector<char *> PreparedCommand::argv(const std::vector<std::string> &values) const
+    {
+        std::vector<char *> argv = m_argv;
+        for (size_t i = 0; i < m_slots.size() && i < values.size(); ++i)
+            argv[m_slots[i]] = const_cast<char *>(values[i].c_str());
+        return argv;
+    }
+}; // namespace cpplib
@@ -0,0 +1,201 @@
+#pragma once
+#include "ProcessUtils.hpp"
+
+namespace cpplib
+{
+    namespace detail
+    {
+        /**
+         * The state and machinery of a Process. It stays at one heap address for the Process's whole life,
+         * so the IO and monitor threads, the reactor and completion handlers keep working while the
+         * Process handle itself is moved.
+         */
+        class ProcessCore
+        {
+        public:
+            using OutputLineCallback = std::function<void(const std::string &)>;
+            using OutputChunkCallback = std::function<void(std::string_view chunk)>;
+            using ExitCallback = std::function<void(int exitCode)>;
+            using OutputEventCallback = std::function<void(const OutputEvent &event)>;
+
+            ~ProcessCore();
+
+            // The operations of Process, see there.
+            int run();
+            int run(std::chrono::milliseconds timeout, const TerminationPolicy &policy);
+            int start();
+            std::future<int> startAsync();
+            CommunicateResult communicate(std::string_view input, const CommunicateOptions &options);
+            int waitForExit();
+            std::optional<int> waitUntil(std::chrono::steady_clock::time_point deadline);
+            int terminate(const TerminationPolicy &policy);
+            bool sendSignal(int signal, bool processGroup);
+            ProcessStats stats() const;
+
+            enum StreamIndex
+            {
+                StdoutIndex = 0,
+                StderrIndex = 1,
+            };
+
+            std::vector<std::string> buildArgv(const std::string &cmd) const;
+            void monitorProcess();
+            void onProcessExit(int exitCode);
+            void onCompleted();
+            void joinThreads();
+            void closeInput();
+
+            /**
+             * Registers handler to run with the exit code once the process has completed.
+             * @param id If not null, receives an id for removeCompletionHandler().
+             * @return false, without registering it, if the process has already completed or was not started.
+             */
+            bool addCompletionHandler(std::function<void(int)> handler, uint64_t *id = nullptr);
+            /** Unregisters a handler that has not run yet, does nothing if it already ran. */
+            void removeCompletionHandler(uint64_t id);
+            /** True once a started, non-detached process has completed (see onCompleted()). */
+            bool completed();
+            /**
+             * Returns true if popLine() has a line or the end of the output to return,
+             * otherwise registers waiter to be called once it has.
+             */
+            bool lineReady(std::function<void()> waiter);
+            std::optional<std::string> popLine();
+            void queueLine(std::string line);
+
+            void readStream(StreamIndex stream);
+            void readStreamsMerged();
+            void dispatchOutput(StreamIndex stream, std::string_view chunk);
+            void dispatchLengthPrefixed(StreamIndex stream, std::string_view chunk);
+            void deliverRecord(StreamIndex stream, std::string &record);
+            void onStreamClosed(StreamIndex stream);
+            void countOutput(StreamIndex stream, size_t bytes);
+            /** Clears the statistics, tails and collected events of the previous run. */
+            void resetRunState();
+
+            void closePipes();
+
+            void startIOThreads();
+
+    #ifdef _WIN32
+            wchar_t *buildEnvironmentBlock(const std::vector<std::string> &environment);
+    #else
+            void closePipe(int pipeFd[2], bool openFlags[2], int endsToClose = 2);
+            /**
+             * Waits for the child, through its pidfd when there is one.
+             * @return false if block is not set and the child is still running, otherwise true with exitCode set,
+             * -1 if waiting failed (e.g. ECHILD when something else reaped the child).
+             */
+            static bool reapChild(pid_t pid, int pidfd, bool block, int &exitCode, ProcessStats *stats = nullptr);
+            ssize_t transferCapture(StreamIndex stream, bool nonBlocking);
+
+            char *const *buildArgvArray(const std::vector<std::string> &argv) const;
+            void freeArgvArray(char *const *argv) const;
+    #endif
+
+            std::filesystem::path m_exePath;
+            std::vector<std::string> m_arguments;
+            const PreparedCommand *m_preparedCommand = nullptr;
+            std::vector<std::string> m_slotValues;
+            std::string m_workingDirectory;
+            std::vector<std::string> m_environment;
+            bool m_hasCustomEnvironment = false;
+#ifndef _WIN32
+            std::vector<std::pair<int, int>> m_fdMappings; // parent fd, child fd
+            bool m_closeOtherFds = false;
+#endif
+#ifdef __linux__
+            std::vector<std::pair<std::string, int>> m_sharedRings; // environment variable, fd
+#endif
+#ifndef _WIN32
+            std::optional<int> m_nice;
+            std::vector<ResourceLimit> m_resourceLimits;
+#endif
+#ifdef __linux__
+            std::vector<int> m_cpuAffinity;
+            SchedulingPolicy m_schedulingPolicy = SchedulingPolicy::Inherit;
+            IoPriorityClass m_ioPriorityClass = IoPriorityClass::Inherit;
+            int m_ioPriorityLevel = 4;
+            std::filesystem::path m_cgroup;
+#endif
+            bool m_detached = false;
+            bool m_newProcessGroup = false;
+            StreamRedirect m_stdinRedirect;
+            StreamRedirect m_stdoutRedirect;
+            StreamRedirect m_stderrRedirect;
+            SpawnBackend m_spawnBackend = SpawnBackend::Vfork;
+            OutputLineCallback m_outputCallback = nullptr;
+            OutputLineCallback m_errorCallback = nullptr;
+            OutputChunkCallback m_outputChunkCallback = nullptr;
+            OutputChunkCallback m_errorChunkCallback = nullptr;
+            ExitCallback m_exitCallback = nullptr;
+            bool m_queueOutputLines = false;
+            bool m_manualIO = false; // set by communicate(): start() leaves the IO and exit detection to the caller
+            std::atomic<int> m_exitCode{-1};
+    #ifndef _WIN32
+            int m_pidfd = -1;
+            // Files written by CaptureToFile streams, and whether splice(2) still works for them.
+            int m_captureFd[2] = {-1, -1};
+            bool m_captureSplice[2] = {false, false};
+            int m_captureError[2] = {0, 0};
+            int m_stdOutPipe[2];
+            bool m_stdOutPipeOpen[2] = {false, false};
+            int m_stdErrPipe[2];
+            bool m_stdErrPipeOpen[2] = {false, false};
+            int m_stdInPipe[2];
+            bool m_stdInPipeOpen[2] = {false, false};
+    #else
+            bool m_stdOutPipeOpen = false;
+            bool m_stdErrPipeOpen = false;
+            bool m_stdInPipeOpen = false;
+            HANDLE hStdOutRd = INVALID_HANDLE_VALUE;
+            HANDLE hStdErrRd = INVALID_HANDLE_VALUE;
+            HANDLE hStdInWr = INVALID_HANDLE_VALUE;
+    #endif
+            std::atomic<bool> m_running{false};
+            pid_t m_pid = -1;
+            std::thread m_monitorThread;
+            std::thread m_outputThread;
+            std::thread m_errorThread;
+            std::mutex m_stateMutex;
+            std::condition_variable m_exitCondition;
+            int m_openStreams = 0;
+            bool m_completed = false;
+            std::vector<std::pair<uint64_t, std::function<void(int)>>> m_completionHandlers;
+            uint64_t m_nextCompletionHandler = 0;
+            std::deque<std::string> m_lineQueue;
+            bool m_lineQueueClosed = false;
+            std::function<void()> m_lineWaiter;
+            OutputEventCallback m_outputEventCallback = nullptr;
+            bool m_collectOutputEvents = false;
+            std::vector<OutputEvent> m_outputEvents;
+            std::mutex m_outputEventMutex; // serialises the records of the two streams
+            ProcessStats::Clock::time_point m_readTime[2]; // of the chunk being dispatched
+            RecordFraming m_framing[2];
+            std::string m_partialLine[2]; // the incomplete record of each stream
+            ProcessStats m_stats;
+            // Kept per stream, each one is only updated by the thread reading that stream.
+            uint64_t m_outputBytes[2] = {0, 0};
+            ProcessStats::Clock::time_point m_firstOutput[2];
+            uint64_t m_inputBytes = 0; // written by communicate(), bypassing m_stdinBuf
+            bool m_capturing[2] = {false, false};
+            std::pair<size_t, size_t> m_tailLimits[2] = {{0, 0}, {0, 0}}; // bytes, lines
+            OutputTail m_tail[2];
+            ProcessReactor *m_reactor = nullptr;
+
+    #ifdef _WIN32
+            HANDLE m_processHandle = INVALID_HANDLE_VALUE;
+            HANDLE m_threadHandle = INVALID_HANDLE_VALUE;
+    #endif
+
+            fd_streambuf* m_stdinBuf = nullptr;
+            fd_streambuf* m_stdoutBuf = nullptr;
+            fd_streambuf* m_stderrBuf = nullptr;
+
+            // The owning Process's streams, repointed when it is moved.
+            std::ostream *m_in = nullptr;
+            std::istream *m_out = nullptr;
+            std::istream *m_err = nullptr;
+        };
+    }
+};
@@ -0,0 +1,344 @@
+#include "ProcessGraph.hpp"
+#include "ProcessReactor.hpp"
+#include "JobProcess.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+
+namespace cpplib
+{
+    ProcessGraph::ProcessGraph(size_t maxConcurrent)
+        : m_maxConcurrent(maxConcurrent)
+    {
+        if (m_maxConcurrent == 0)
+            m_maxConcurrent = std::max(1u, std::thread::hardware_concurrency());
+#ifdef __linux__
+        m_reactor = &ProcessReactor::shared();
+#endif
+    }
+
+    ProcessGraph::~ProcessGraph()
+    {
+        cancel();
+
+        std::vector<std::unique_ptr<Process>> finished;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]
+                             { return m_active == 0; });
+            finished.swap(m_finished);
+        }
+    }
+
+    void ProcessGraph::setReactor(ProcessReactor *reactor)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_reactor = reactor;
+    }
+
+    void ProcessGraph::setStopOnFailure(bool stop)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopOnFailure = stop;
+    }
+
+    ProcessGraph::NodeId ProcessGraph::addNode(ProcessJob job, const std::vector<NodeId> &dependencies, std::string name)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_started)
+            throw std::runtime_error("ProcessGraph::addNode(): the graph was already started");
+        NodeId id = m_nodes.size();
+        for (NodeId dependency : dependencies)
+        {
+            if (dependency >= id)
+                throw std::invalid_argument("ProcessGraph::addNode(): unknown dependency " + std::to_string(dependency));
+        }
+        for (NodeId dependency : dependencies)
+            m_nodes[dependency].dependents.push_back(id);
+
+        if (name.empty())
+        {
+            name = job.command.string();
+            for (const std::string &arg : job.arguments)
+                name += " " + arg;
+        }
+        Node node;
+        node.job = std::move(job);
+        node.name = std::move(name);
+        node.waitingFor = dependencies.size();
+        m_nodes.push_back(std::move(node));
+        return id;
+    }
+
+    void ProcessGraph::setCost(const std::string &name, std::chrono::microseconds cost)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_costs[name] = cost.count();
+    }
+
+    std::optional<std::chrono::microseconds> ProcessGraph::cost(const std::string &name) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_costs.find(name);
+        if (it == m_costs.end())
+            return std::nullopt;
+        return std::chrono::microseconds(it->second);
+    }
+
+    void ProcessGraph::loadCosts(const std::filesystem::path &path)
+    {
+        std::ifstream file(path);
+        if (!file)
+            return;
+
+        // One "<microseconds> <name>" per line.
+        std::unordered_map<std::string, int64_t> costs;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            size_t space = line.find(' ');
+            if (space == std::string::npos || space == 0)
+                continue;
+            try
+            {
+                costs[line.substr(space + 1)] = std::stoll(line.substr(0, space));
+            }
+            catch (const std::exception &)
+            {
+                // not a cost line
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &cost : costs)
+            m_costs[cost.first] = cost.second;
+    }
+
+    void ProcessGraph::saveCosts(const std::filesystem::path &path) const
+    {
+        std::filesystem::path temp = path;
+        temp += ".tmp";
+        {
+            std::ofstream file(temp, std::ios::trunc);
+            if (!file)
+                throw std::runtime_error("ProcessGraph::saveCosts(): cannot write " + temp.string());
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (const auto &cost : m_costs)
+            {
+                if (cost.first.find('\n') == std::string::npos)
+                    file << cost.second << ' ' << cost.first << '\n';
+            }
+            file.close();
+            if (!file)
+                throw std::runtime_error("ProcessGraph::saveCosts(): cannot write " + temp.string());
+        }
+        std::filesystem::rename(temp, path);
+    }
+
+    void ProcessGraph::start()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_started)
+                throw std::runtime_error("ProcessGraph::start(): the graph was already started");
+            m_started = true;
+
+            int64_t knownTotal = 0;
+            size_t known = 0;
+            for (const Node &node : m_nodes)
+            {
+                auto it = m_costs.find(node.name);
+                if (it != m_costs.end())
+                {
+                    knownTotal += it->second;
+                    ++known;
+                }
+            }
+            int64_t defaultCost = known ? knownTotal / static_cast<int64_t>(known) : 1;
+
+            // Dependents always come after their dependencies, so one backward pass sees them all first.
+            for (NodeId id = m_nodes.size(); id-- > 0;)
+            {
+                Node &node = m_nodes[id];
+                auto it = m_costs.find(node.name);
+                int64_t longestAfter = 0;
+                for (NodeId dependent : node.dependents)
+                    longestAfter = std::max(longestAfter, m_nodes[dependent].remainingPath);
+                node.remainingPath = std::max<int64_t>(1, it != m_costs.end() ? it->second : defaultCost) + longestAfter;
+                m_criticalPath = std::max(m_criticalPath, node.remainingPath);
+            }
+
+            m_unfinished = m_nodes.size();
+            for (NodeId id = 0; id < m_nodes.size(); ++id)
+            {
+                if (m_nodes[id].waitingFor == 0)
+                    m_ready.push({m_nodes[id].remainingPath, m_nodes[id].job.priority, id});
+            }
+            m_condition.notify_all();
+        }
+        fillSlots();
+    }
+
+    std::optional<ProcessGraph::Result> ProcessGraph::next()
+    {
+        std::vector<std::unique_ptr<Process>> finished;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this]
+                         { return !m_results.empty() || m_unfinished == 0; });
+
+        // Destroyed after the lock is released, at the end of this function.
+        finished.swap(m_finished);
+
+        if (m_results.empty())
+            return std::nullopt;
+        Result result = std::move(m_results.front());
+        m_results.pop_front();
+        return result;
+    }
+
+    bool ProcessGraph::run()
+    {
+        start();
+        bool succeeded = true;
+        while (auto result = next())
+            succeeded = succeeded && result->state == NodeState::Succeeded;
+        return succeeded;
+    }
+
+    size_t ProcessGraph::cancel()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_started)
+            return 0;
+        size_t before = m_unfinished;
+        for (NodeId id = 0; id < m_nodes.size(); ++id)
+            skipLocked(id);
+        m_condition.notify_all();
+        return before - m_unfinished;
+    }
+
+    ProcessGraph::NodeState ProcessGraph::state(NodeId id) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (id >= m_nodes.size())
+            throw std::invalid_argument("ProcessGraph::state(): unknown node " + std::to_string(id));
+        return m_nodes[id].state;
+    }
+
+    std::chrono::microseconds ProcessGraph::criticalPath() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return std::chrono::microseconds(m_criticalPath);
+    }
+
+    size_t ProcessGraph::size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_nodes.size();
+    }
+
+    size_t ProcessGraph::running() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_active;
+    }
+
+    void ProcessGraph::fillSlots()
+    {
+        while (true)
+        {
+            NodeId id;
+            ProcessJob job;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                // Nodes skipped while they waited in the queue are dropped here.
+                while (!m_ready.empty() && m_nodes[m_ready.top().id].state != NodeState::Pending)
+                    m_ready.pop();
+                if (m_active >= m_maxConcurrent || m_ready.empty())
+                    return;
+                id = m_ready.top().id;
+                m_ready.pop();
+                Node &node = m_nodes[id];
+                node.state = NodeState::Running;
+                node.started = std::chrono::steady_clock::now();
+                job = std::move(node.job);
+                ++m_active;
+            }
+            auto error = detail::startJobProcess(id, std::move(job), m_mutex, m_reactor, m_running, [this, id](int exitCode)
+                                                 { onNodeFinished(id, exitCode, std::string()); });
+            if (error)
+                recordFinished(id, -1, std::move(*error));
+        }
+    }
+
+    void ProcessGraph::onNodeFinished(NodeId id, int exitCode, std::string error)
+    {
+        recordFinished(id, exitCode, std::move(error));
+        fillSlots();
+    }
+
+    void ProcessGraph::recordFinished(NodeId id, int exitCode, std::string error)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_running.find(id);
+        if (it != m_running.end())
+        {
+            m_finished.push_back(std::move(it->second));
+            m_running.erase(it);
+        }
+        --m_active;
+        --m_unfinished;
+
+        Node &node = m_nodes[id];
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - node.started);
+        bool succeeded = error.empty() && exitCode == 0;
+        node.state = succeeded ? NodeState::Succeeded : NodeState::Failed;
+        m_results.push_back(Result{id, node.state, exitCode, std::move(error), duration});
+
+        if (succeeded)
+        {
+            // Averaged with the previous estimate, so one slow run does not dominate.
+            auto cost = m_costs.find(node.name);
+            if (cost == m_costs.end())
+                m_costs.emplace(node.name, duration.count());
+            else
+                cost->second = (cost->second + duration.count()) / 2;
+
+            for (NodeId dependent : node.dependents)
+            {
+                Node &next = m_nodes[dependent];
+                if (--next.waitingFor == 0 && next.state == NodeState::Pending)
+                    m_ready.push({next.remainingPath, next.job.priority, dependent});
+            }
+        }
+        else if (m_stopOnFailure)
+        {
+            for (NodeId other = 0; other < m_nodes.size(); ++other)
+                skipLocked(other);
+        }
+        else
+        {
+            for (NodeId dependent : node.dependents)
+                skipLocked(dependent);
+        }
+        m_condition.notify_all();
+    }
+
+    void ProcessGraph::skipLocked(NodeId id)
+    {
+        std::vector<NodeId> stack{id};
+        while (!stack.empty())
+        {
+            NodeId current = stack.back();
+            stack.pop_back();
+            Node &node = m_nodes[current];
+            if (node.state != NodeState::Pending)
+                continue;
+            node.state = NodeState::Skipped;
+            --m_unfinished;
+            m_results.push_back(Result{current, NodeState::Skipped, -1, std::string(), std::chrono::microseconds(0)});
+            stack.insert(stack.end(), node.dependents.begin(), node.dependents.end());
+        }
+    }
+};
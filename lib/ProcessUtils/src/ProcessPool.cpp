@@ -0,0 +1,145 @@
+#include "ProcessPool.hpp"
+#include "ProcessReactor.hpp"
+#include "JobProcess.hpp"
+#include <stdexcept>
+#include <algorithm>
+
+namespace cpplib
+{
+    ProcessPool::ProcessPool(size_t maxConcurrent)
+        : m_maxConcurrent(maxConcurrent)
+    {
+        if (m_maxConcurrent == 0)
+            m_maxConcurrent = std::max(1u, std::thread::hardware_concurrency());
+#ifdef __linux__
+        m_reactor = &ProcessReactor::shared();
+#endif
+    }
+
+    ProcessPool::~ProcessPool()
+    {
+        cancelAll();
+
+        std::vector<std::unique_ptr<Process>> finished;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]
+                             { return m_active == 0; });
+            finished.swap(m_finished);
+        }
+    }
+
+    void ProcessPool::setReactor(ProcessReactor *reactor)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_reactor = reactor;
+    }
+
+    ProcessPool::JobId ProcessPool::submit(ProcessJob job)
+    {
+        JobId id;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            id = m_nextId++;
+            m_queuedPriority[id] = job.priority;
+            m_queue.emplace(std::make_pair(-job.priority, id), std::move(job));
+        }
+        fillSlots();
+        return id;
+    }
+
+    bool ProcessPool::cancel(JobId id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_queuedPriority.find(id);
+        if (it == m_queuedPriority.end())
+            return false;
+        m_queue.erase(std::make_pair(-it->second, id));
+        m_queuedPriority.erase(it);
+        m_condition.notify_all();
+        return true;
+    }
+
+    size_t ProcessPool::cancelAll()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t count = m_queue.size();
+        m_queue.clear();
+        m_queuedPriority.clear();
+        m_condition.notify_all();
+        return count;
+    }
+
+    std::optional<ProcessPool::Result> ProcessPool::next()
+    {
+        std::vector<std::unique_ptr<Process>> finished;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this]
+                         { return !m_results.empty() || (m_queue.empty() && m_active == 0); });
+
+        // Destroyed after the lock is released, at the end of this function.
+        finished.swap(m_finished);
+
+        if (m_results.empty())
+            return std::nullopt;
+        Result result = std::move(m_results.front());
+        m_results.pop_front();
+        return result;
+    }
+
+    size_t ProcessPool::queued() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_queue.size();
+    }
+
+    size_t ProcessPool::running() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_active;
+    }
+
+    void ProcessPool::fillSlots()
+    {
+        while (true)
+        {
+            JobId id;
+            ProcessJob job;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_active >= m_maxConcurrent || m_queue.empty())
+                    return;
+                auto first = m_queue.begin();
+                id = first->first.second;
+                job = std::move(first->second);
+                m_queue.erase(first);
+                m_queuedPriority.erase(id);
+                ++m_active;
+            }
+            auto error = detail::startJobProcess(id, std::move(job), m_mutex, m_reactor, m_running, [this, id](int exitCode)
+                                                 { onJobFinished(id, exitCode, std::string()); });
+            if (error)
+                recordFinished(id, -1, std::move(*error));
+        }
+    }
+
+    void ProcessPool::onJobFinished(JobId id, int exitCode, std::string error)
+    {
+        recordFinished(id, exitCode, std::move(error));
+        fillSlots();
+    }
+
+    void ProcessPool::recordFinished(JobId id, int exitCode, std::string error)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_running.find(id);
+        if (it != m_running.end())
+        {
+            m_finished.push_back(std::move(it->second));
+            m_running.erase(it);
+        }
+        --m_active;
+        m_results.push_back(Result{id, exitCode, std::move(error)});
+        m_condition.notify_all();
+    }
+};
@@ -0,0 +1,429 @@
+#include "ProcessReactor.hpp"
+#include "ProcessUtils.hpp"
+#include "ProcessCore.hpp"
+#include <stdexcept>
+#include <cstring>
+#include <atomic>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <cerrno>
+#endif
+
+namespace cpplib
+{
+#ifdef __linux__
+    struct ProcessReactor::Watch
+    {
+        enum Kind
+        {
+            Stdout,
+            Stderr,
+            Exit,
+            ChildSignal,
+        };
+
+        detail::ProcessCore *proc;
+        Kind kind;
+        int fd;
+    };
+
+    namespace
+    {
+        const int maxSignalSlots = 16;
+
+        // Self-pipe write ends of the reactors using the SIGCHLD fallback, stored as fd + 1.
+        std::atomic<int> signalFds[maxSignalSlots];
+        struct sigaction previousChildAction;
+        std::once_flag childHandlerInstalled;
+
+        void childSignalHandler(int sig, siginfo_t *info, void *context)
+        {
+            int savedErrno = errno;
+            for (auto &slot : signalFds)
+            {
+                int fd = slot.load() - 1;
+                if (fd >= 0)
+                {
+                    char c = 0;
+                    ssize_t ignored = ::write(fd, &c, 1);
+                    (void)ignored;
+                }
+            }
+            errno = savedErrno;
+
+            if (previousChildAction.sa_flags & SA_SIGINFO)
+            {
+                if (previousChildAction.sa_sigaction)
+                    previousChildAction.sa_sigaction(sig, info, context);
+            }
+            else if (previousChildAction.sa_handler != SIG_DFL && previousChildAction.sa_handler != SIG_IGN)
+            {
+                previousChildAction.sa_handler(sig);
+            }
+        }
+
+        void installChildHandler()
+        {
+            std::call_once(childHandlerInstalled, []()
+                           {
+                struct sigaction sa;
+                std::memset(&sa, 0, sizeof(sa));
+                sa.sa_sigaction = childSignalHandler;
+                sa.sa_flags = SA_SIGINFO | SA_RESTART | SA_NOCLDSTOP;
+                sigemptyset(&sa.sa_mask);
+                sigaction(SIGCHLD, &sa, &previousChildAction); });
+        }
+    }
+
+    ProcessReactor::ProcessReactor(unsigned threadCount)
+    {
+        m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (m_epollFd == -1)
+            throw std::runtime_error("epoll_create1() failed");
+
+        m_stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (m_stopFd == -1)
+        {
+            close(m_epollFd);
+            throw std::runtime_error("eventfd() failed");
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_stopFd, &ev);
+
+        if (threadCount == 0)
+            threadCount = 1;
+        for (unsigned i = 0; i < threadCount; ++i)
+            m_threads.emplace_back(&ProcessReactor::run, this);
+    }
+
+    ProcessReactor::~ProcessReactor()
+    {
+        uint64_t one = 1;
+        ssize_t ignored = ::write(m_stopFd, &one, sizeof(one));
+        (void)ignored;
+        for (auto &thread : m_threads)
+            thread.join();
+
+        if (m_signalSlot != -1)
+            signalFds[m_signalSlot] = 0;
+        if (m_signalPipe[0] != -1)
+        {
+            close(m_signalPipe[0]);
+            close(m_signalPipe[1]);
+        }
+        delete m_signalWatch;
+        close(m_stopFd);
+        close(m_epollFd);
+    }
+
+    ProcessReactor &ProcessReactor::shared()
+    {
+        // Never destroyed, processes may still be running during static destruction.
+        static ProcessReactor *reactor = new ProcessReactor(1);
+        return *reactor;
+    }
+
+    void ProcessReactor::add(Watch *watch, int fd)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_watchMutex);
+            if (!m_error)
+            {
+                epoll_event ev{};
+                ev.events = EPOLLIN | EPOLLONESHOT;
+                ev.data.ptr = watch;
+                if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) == -1)
+                    throw std::runtime_error(std::string("epoll_ctl() failed: ") + std::strerror(errno));
+                m_armed.insert(watch);
+                return;
+            }
+        }
+        handOver(watch);
+    }
+
+    void ProcessReactor::rearm(Watch *watch, int fd)
+    {
+        {
+            // Armed under the lock, another thread may receive its next event as soon as epoll_ctl() returns.
+            std::lock_guard<std::mutex> lock(m_watchMutex);
+            if (!m_error)
+            {
+                m_armed.insert(watch);
+                epoll_event ev{};
+                ev.events = EPOLLIN | EPOLLONESHOT;
+                ev.data.ptr = watch;
+                epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &ev);
+                return;
+            }
+        }
+        handOver(watch);
+    }
+
+    void ProcessReactor::remove(int fd)
+    {
+        epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    void ProcessReactor::attach(detail::ProcessCore *proc)
+    {
+        if (proc->m_stdoutBuf)
+        {
+            int outFd = proc->m_stdOutPipe[0];
+            fcntl(outFd, F_SETFL, fcntl(outFd, F_GETFL) | O_NONBLOCK);
+            add(new Watch{proc, Watch::Stdout, outFd}, outFd);
+        }
+        if (proc->m_stderrBuf)
+        {
+            int errFd = proc->m_stdErrPipe[0];
+            fcntl(errFd, F_SETFL, fcntl(errFd, F_GETFL) | O_NONBLOCK);
+            add(new Watch{proc, Watch::Stderr, errFd}, errFd);
+        }
+
+        if (proc->m_pidfd != -1)
+        {
+            add(new Watch{proc, Watch::Exit, proc->m_pidfd}, proc->m_pidfd);
+            return;
+        }
+
+        // No pidfd: fall back to scanning on SIGCHLD.
+        {
+            std::lock_guard<std::mutex> lock(m_pendingMutex);
+            if (!m_signalWatch)
+            {
+                if (pipe2(m_signalPipe, O_CLOEXEC | O_NONBLOCK) == -1)
+                    throw std::runtime_error("pipe() failed");
+                for (int i = 0; i < maxSignalSlots && m_signalSlot == -1; ++i)
+                {
+                    int expected = 0;
+                    if (signalFds[i].compare_exchange_strong(expected, m_signalPipe[1] + 1))
+                        m_signalSlot = i;
+                }
+                if (m_signalSlot == -1)
+                    throw std::runtime_error("Too many ProcessReactor instances without pidfd support");
+                installChildHandler();
+                m_signalWatch = new Watch{nullptr, Watch::ChildSignal, m_signalPipe[0]};
+                add(m_signalWatch, m_signalPipe[0]);
+            }
+            if (!m_error)
+                m_pendingExits.push_back(new Watch{proc, Watch::Exit, -1});
+            else
+                handOver(new Watch{proc, Watch::Exit, -1});
+        }
+
+        // The child may have exited before it was added, force a scan.
+        char c = 0;
+        ssize_t ignored = ::write(m_signalPipe[1], &c, 1);
+        (void)ignored;
+    }
+
+    void ProcessReactor::run()
+    {
+        epoll_event events[64];
+        while (true)
+        {
+            int count = epoll_wait(m_epollFd, events, 64, -1);
+            if (count == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                fail(errno);
+                return;
+            }
+
+            for (int i = 0; i < count; ++i)
+            {
+                Watch *watch = static_cast<Watch *>(events[i].data.ptr);
+                if (!watch)
+                    return; // stop requested, the eventfd stays readable for the other threads
+                {
+                    std::lock_guard<std::mutex> lock(m_watchMutex);
+                    if (!m_armed.erase(watch))
+                        continue; // handed over by fail()
+                }
+
+                switch (watch->kind)
+                {
+                case Watch::Stdout:
+                case Watch::Stderr:
+                    handleStream(watch);
+                    break;
+                case Watch::Exit:
+                    handleExit(watch);
+                    break;
+                case Watch::ChildSignal:
+                    handleChildSignal();
+                    break;
+                }
+            }
+        }
+    }
+
+    void ProcessReactor::fail(int error)
+    {
+        std::vector<Watch *> watches;
+        {
+            std::lock_guard<std::mutex> lock(m_watchMutex);
+            if (m_error)
+                return;
+            m_error = error;
+            watches.assign(m_armed.begin(), m_armed.end());
+            m_armed.clear();
+        }
+        {
+            // attach() checks m_error under this lock, a process it adds from now on is handed over by it.
+            std::lock_guard<std::mutex> lock(m_pendingMutex);
+            watches.insert(watches.end(), m_pendingExits.begin(), m_pendingExits.end());
+            m_pendingExits.clear();
+        }
+        // Watches being handled by other threads are handed over when they would be rearmed.
+        for (Watch *watch : watches)
+        {
+            if (watch != m_signalWatch)
+                handOver(watch);
+        }
+    }
+
+    void ProcessReactor::handOver(Watch *watch)
+    {
+        if (watch->kind == Watch::ChildSignal)
+            return; // owned by the reactor, deleted with it
+        detail::ProcessCore *proc = watch->proc;
+        if (watch->fd != -1)
+            remove(watch->fd);
+        {
+            // Held until the thread is stored: it cannot complete the process, whose waiter joins it, before.
+            std::lock_guard<std::mutex> lock(proc->m_stateMutex);
+            if (watch->kind == Watch::Exit)
+            {
+                proc->m_monitorThread = std::thread(&detail::ProcessCore::monitorProcess, proc);
+            }
+            else
+            {
+                fcntl(watch->fd, F_SETFL, fcntl(watch->fd, F_GETFL) & ~O_NONBLOCK);
+                if (watch->kind == Watch::Stdout)
+                    proc->m_outputThread = std::thread(&detail::ProcessCore::readStream, proc, detail::ProcessCore::StdoutIndex);
+                else
+                    proc->m_errorThread = std::thread(&detail::ProcessCore::readStream, proc, detail::ProcessCore::StderrIndex);
+            }
+        }
+        delete watch;
+    }
+
+    void ProcessReactor::handleStream(Watch *watch)
+    {
+        detail::ProcessCore *proc = watch->proc;
+        detail::ProcessCore::StreamIndex stream = watch->kind == Watch::Stdout ? detail::ProcessCore::StdoutIndex : detail::ProcessCore::StderrIndex;
+        fd_streambuf *buf = stream == detail::ProcessCore::StdoutIndex ? proc->m_stdoutBuf : proc->m_stderrBuf;
+
+        // Bounded so one chatty child cannot starve the others.
+        bool closed = false;
+        for (int i = 0; i < 16 && !closed; ++i)
+        {
+            if (proc->m_capturing[stream])
+            {
+                ssize_t moved = proc->transferCapture(stream, true);
+                if (moved == -1)
+                    break;
+                closed = moved == 0;
+                continue;
+            }
+
+            std::string_view chunk = buf->readChunk();
+            if (chunk.empty())
+            {
+                closed = buf->atEof();
+                break;
+            }
+            proc->countOutput(stream, chunk.size());
+            proc->m_tail[stream].append(chunk);
+            proc->dispatchOutput(stream, chunk);
+        }
+
+        if (closed)
+        {
+            remove(watch->fd);
+            delete watch;
+            proc->onStreamClosed(stream);
+            return;
+        }
+        rearm(watch, watch->fd);
+    }
+
+    void ProcessReactor::handleExit(Watch *watch)
+    {
+        detail::ProcessCore *proc = watch->proc;
+        int exitCode = -1;
+        if (!detail::ProcessCore::reapChild(proc->m_pid, watch->fd, false, exitCode, &proc->m_stats))
+        {
+            rearm(watch, watch->fd);
+            return;
+        }
+        remove(watch->fd);
+        delete watch;
+        proc->onProcessExit(exitCode);
+    }
+
+    void ProcessReactor::handleChildSignal()
+    {
+        char drain[64];
+        while (::read(m_signalPipe[0], drain, sizeof(drain)) > 0)
+            ;
+
+        std::vector<std::pair<detail::ProcessCore *, int>> exited;
+        {
+            std::lock_guard<std::mutex> lock(m_pendingMutex);
+            for (size_t i = 0; i < m_pendingExits.size();)
+            {
+                Watch *watch = m_pendingExits[i];
+                int exitCode = -1;
+                if (detail::ProcessCore::reapChild(watch->proc->m_pid, -1, false, exitCode, &watch->proc->m_stats))
+                {
+                    exited.emplace_back(watch->proc, exitCode);
+                    delete watch;
+                    m_pendingExits[i] = m_pendingExits.back();
+                    m_pendingExits.pop_back();
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
+        rearm(m_signalWatch, m_signalPipe[0]);
+
+        for (auto &entry : exited)
+            entry.first->onProcessExit(entry.second);
+    }
+#else
+    struct ProcessReactor::Watch
+    {
+    };
+
+    ProcessReactor::ProcessReactor(unsigned threadCount)
+    {
+        (void)threadCount;
+        throw std::runtime_error("ProcessReactor is only supported on Linux");
+    }
+
+    ProcessReactor::~ProcessReactor()
+    {
+    }
+
+    ProcessReactor &ProcessReactor::shared()
+    {
+        static ProcessReactor *reactor = new ProcessReactor(1);
+        return *reactor;
+    }
+
+    void ProcessReactor::attach(detail::ProcessCore *)
+    {
+    }
+#endif
+}; // namespace cpplib
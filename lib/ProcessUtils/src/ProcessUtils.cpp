@@ -1,7 +1,12 @@
 #include "ProcessUtils.hpp"
+#include "ProcessCore.hpp"
+#include "ProcessReactor.hpp"
+#include "ChildSpawn.hpp"
+#include "SharedRing.hpp"
 #include <iostream>
 #include <cstring>
 #include <stdexcept>
+#include <algorithm>
 #include <thread>
 
 #ifdef _WIN32
@@ -12,9 +17,20 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <pwd.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <cerrno>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sched.h>
+
+extern char **environ;
+#endif
 #endif
 
 #define CLOSE_PIPE(pipe, end) \
@@ -22,25 +38,90 @@
 
 namespace cpplib
 {
+    using detail::ProcessCore;
 
 #ifdef _WIN32
-    fd_streambuf::fd_streambuf(HANDLE h, bool read_mode)
-        : buffer(buf_size), handle(h), readable(read_mode)
+    fd_streambuf::fd_streambuf(HANDLE h, bool read_mode, size_t size)
+        : buffer(size ? size : buf_size), handle(h), readable(read_mode)
     {
         if (readable)
             setg(buffer.data(), buffer.data(), buffer.data());
         else
             setp(buffer.data(), buffer.data() + buffer.size());
     }
+
+    std::streamsize fd_streambuf::readSome(char *dst, size_t size)
+    {
+        DWORD read = 0;
+        if (!ReadFile(handle, dst, (DWORD)std::min<size_t>(size, MAXDWORD), &read, nullptr) || read == 0)
+        {
+            at_eof = true;
+            return 0;
+        }
+        transferred += read;
+        return read;
+    }
+
+    bool fd_streambuf::writeAll(const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            DWORD written = 0;
+            if (!WriteFile(handle, data, (DWORD)std::min<size_t>(size, MAXDWORD), &written, nullptr))
+                return false;
+            transferred += written;
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
 #else
-    fd_streambuf::fd_streambuf(int f, bool read_mode)
-        : buffer(buf_size), fd(f), readable(read_mode)
+    fd_streambuf::fd_streambuf(int f, bool read_mode, size_t size)
+        : buffer(size ? size : buf_size), fd(f), readable(read_mode)
     {
         if (readable)
             setg(buffer.data(), buffer.data(), buffer.data());
         else
             setp(buffer.data(), buffer.data() + buffer.size());
     }
+
+    std::streamsize fd_streambuf::readSome(char *dst, size_t size)
+    {
+        ssize_t read;
+        do
+            read = ::read(fd, dst, size);
+        while (read == -1 && errno == EINTR);
+        if (read <= 0)
+        {
+            // EAGAIN on a non-blocking fd only means "nothing yet"
+            if (read == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            {
+                at_eof = true;
+                return 0;
+            }
+            return -1;
+        }
+        transferred += read;
+        return read;
+    }
+
+    bool fd_streambuf::writeAll(const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            transferred += written;
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
 #endif
 
     int fd_streambuf::sync()
@@ -54,17 +135,10 @@ namespace cpplib
     {
         if (!readable)
         {
-            size_t n = pptr() - pbase();
-#ifdef _WIN32
-            DWORD written = 0;
-            if (n > 0 && !WriteFile(handle, buffer.data(), (DWORD)n, &written, nullptr))
-                return EOF;
-#else
-            ssize_t written = ::write(fd, buffer.data(), n);
-            if (written < 0)
-                return EOF;
-#endif
+            bool written = writeAll(pbase(), pptr() - pbase());
             setp(buffer.data(), buffer.data() + buffer.size());
+            if (!written)
+                return EOF;
             if (ch != EOF)
                 sputc(ch);
             return 0;
@@ -76,21 +150,77 @@ namespace cpplib
     {
         if (readable)
         {
-#ifdef _WIN32
-            DWORD read = 0;
-            if (!ReadFile(handle, buffer.data(), (DWORD)buffer.size(), &read, nullptr) || read == 0)
-                return EOF;
-#else
-            ssize_t read = ::read(fd, buffer.data(), buffer.size());
+            if (gptr() < egptr())
+                return (unsigned char)*gptr();
+            std::streamsize read = readSome(buffer.data(), buffer.size());
             if (read <= 0)
                 return EOF;
-#endif
             setg(buffer.data(), buffer.data(), buffer.data() + read);
             return (unsigned char)*gptr();
         }
         return EOF;
     }
 
+    std::streamsize fd_streambuf::xsgetn(char *s, std::streamsize n)
+    {
+        if (!readable)
+            return 0;
+        std::streamsize done = std::min<std::streamsize>(n, egptr() - gptr());
+        std::memcpy(s, gptr(), done);
+        gbump(static_cast<int>(done));
+
+        // Large requests are read straight into the caller's memory, the rest goes through the buffer.
+        while (done < n)
+        {
+            std::streamsize read;
+            if (n - done >= static_cast<std::streamsize>(buffer.size()))
+            {
+                read = readSome(s + done, n - done);
+            }
+            else
+            {
+                if (underflow() == EOF)
+                    break;
+                read = std::min<std::streamsize>(n - done, egptr() - gptr());
+                std::memcpy(s + done, gptr(), read);
+                gbump(static_cast<int>(read));
+            }
+            if (read <= 0)
+                break;
+            done += read;
+        }
+        return done;
+    }
+
+    std::streamsize fd_streambuf::xsputn(const char *s, std::streamsize n)
+    {
+        if (readable)
+            return 0;
+        if (n < epptr() - pptr())
+        {
+            std::memcpy(pptr(), s, n);
+            pbump(static_cast<int>(n));
+            return n;
+        }
+        if (overflow(EOF) == EOF)
+            return 0;
+        // Writes at least as large as the buffer skip it.
+        if (n >= static_cast<std::streamsize>(buffer.size()))
+            return writeAll(s, n) ? n : 0;
+        std::memcpy(pptr(), s, n);
+        pbump(static_cast<int>(n));
+        return n;
+    }
+
+    std::string_view fd_streambuf::readChunk()
+    {
+        if (gptr() == egptr() && underflow() == EOF)
+            return {};
+        std::string_view chunk(gptr(), egptr() - gptr());
+        setg(eback(), egptr(), egptr());
+        return chunk;
+    }
+
     size_t fd_streambuf::available() const
     {
         return egptr() - gptr(); // number of bytes currently buffered
@@ -112,80 +242,450 @@ namespace cpplib
     }
 #endif
 
-    Process::~Process()
+    ProcessCore::~ProcessCore()
     {
-        if (m_monitorThread.joinable())
+        if (!m_detached && m_pid != -1)
         {
-            m_monitorThread.join();
+            waitForExit();
         }
+        joinThreads();
 
         if (m_stdoutBuf)
         {
-            m_stdoutBuf->sync();
-            out.rdbuf(nullptr);
+            m_out->rdbuf(nullptr);
             delete m_stdoutBuf;
             m_stdoutBuf = nullptr;
         }
         if (m_stderrBuf)
         {
-            m_stderrBuf->sync();
-            err.rdbuf(nullptr);
+            m_err->rdbuf(nullptr);
             delete m_stderrBuf;
             m_stderrBuf = nullptr;
         }
         if (m_stdinBuf)
         {
-            m_stdinBuf->sync();
-            in.rdbuf(nullptr);
+            m_in->rdbuf(nullptr);
             delete m_stdinBuf;
             m_stdinBuf = nullptr;
         }
 
-        if (m_running && !m_detached)
+        closePipes();
+    }
+
+    void ProcessCore::joinThreads()
+    {
+        // A completion handler or coroutine resumed on one of these threads may destroy the Process.
+        for (std::thread *thread : {&m_monitorThread, &m_outputThread, &m_errorThread})
         {
-            waitForExit();
+            if (!thread->joinable())
+                continue;
+            if (thread->get_id() == std::this_thread::get_id())
+                thread->detach();
+            else
+                thread->join();
         }
+    }
 
-        closePipes();
+    void ProcessCore::onProcessExit(int exitCode)
+    {
+        bool done;
+        {
+            std::lock_guard<std::mutex> lock(m_stateMutex);
+            m_stats.exited = ProcessStats::Clock::now();
+            m_exitCode = exitCode;
+            m_running = false;
+            done = m_openStreams == 0;
+        }
+        if (done)
+            onCompleted();
     }
 
-    void Process::startIOThreads()
+    void ProcessCore::onCompleted()
     {
-        std::thread outputThread([this]()
-                                 {
-            std::string line;
-            while (std::getline(out, line)) {
-                if (m_outputCallback)
-                {
-                    m_outputCallback(line + '\n');
+        if (m_exitCallback)
+            m_exitCallback(m_exitCode);
+
+        int exitCode = m_exitCode;
+        std::vector<std::pair<uint64_t, std::function<void(int)>>> handlers;
+        {
+            // Notify under the lock: a woken waiter may destroy this object right after.
+            std::lock_guard<std::mutex> lock(m_stateMutex);
+            handlers.swap(m_completionHandlers);
+            m_completed = true;
+            m_exitCondition.notify_all();
+        }
+
+        // this may already be destroyed, only use the local copies.
+        for (auto &handler : handlers)
+            handler.second(exitCode);
+    }
+
+    bool ProcessCore::addCompletionHandler(std::function<void(int)> handler, uint64_t *id)
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        if (m_completed || m_detached || m_pid == -1)
+            return false;
+        if (id)
+            *id = m_nextCompletionHandler;
+        m_completionHandlers.emplace_back(m_nextCompletionHandler++, std::move(handler));
+        return true;
+    }
+
+    void ProcessCore::removeCompletionHandler(uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        for (auto it = m_completionHandlers.begin(); it != m_completionHandlers.end(); ++it)
+        {
+            if (it->first == id)
+            {
+                m_completionHandlers.erase(it);
+                return;
+            }
+        }
+    }
+
+    bool ProcessCore::completed()
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        return m_completed && !m_detached && m_pid != -1;
+    }
+
+    std::future<int> ProcessCore::startAsync()
+    {
+        auto promise = std::make_shared<std::promise<int>>();
+        std::future<int> future = promise->get_future();
+
+        // Registered after start() since start() resets the completion state, a fast exit is caught below.
+        start();
+        if (!addCompletionHandler([promise](int exitCode)
+                                  { promise->set_value(exitCode); }))
+            promise->set_value(m_exitCode);
+        return future;
+    }
+
+    bool ProcessCore::lineReady(std::function<void()> waiter)
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        if (!m_lineQueue.empty() || m_lineQueueClosed)
+            return true;
+        m_lineWaiter = std::move(waiter);
+        return false;
+    }
+
+    std::optional<std::string> ProcessCore::popLine()
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+        if (m_lineQueue.empty())
+            return std::nullopt;
+        std::string line = std::move(m_lineQueue.front());
+        m_lineQueue.pop_front();
+        return line;
+    }
+
+    void ProcessCore::queueLine(std::string line)
+    {
+        std::function<void()> waiter;
+        {
+            std::lock_guard<std::mutex> lock(m_stateMutex);
+            m_lineQueue.push_back(std::move(line));
+            waiter.swap(m_lineWaiter);
+        }
+        if (waiter)
+            waiter();
+    }
+
+    void ProcessCore::startIOThreads()
+    {
+#ifndef _WIN32
+        // One reader for both pipes keeps the merged records in read order.
+        bool merged = m_outputEventCallback || m_collectOutputEvents;
+        if (merged && m_stdoutBuf && m_stderrBuf && !m_capturing[StdoutIndex] && !m_capturing[StderrIndex])
+        {
+            m_outputThread = std::thread(&ProcessCore::readStreamsMerged, this);
+            return;
+        }
+#endif
+        if (m_stdoutBuf)
+            m_outputThread = std::thread(&ProcessCore::readStream, this, StdoutIndex);
+        if (m_stderrBuf)
+            m_errorThread = std::thread(&ProcessCore::readStream, this, StderrIndex);
+    }
+
+    void ProcessCore::readStream(StreamIndex stream)
+    {
+#ifndef _WIN32
+        if (m_capturing[stream])
+        {
+            while (transferCapture(stream, false) != 0)
+                ;
+            onStreamClosed(stream);
+            return;
+        }
+#endif
+        fd_streambuf *buf = stream == StdoutIndex ? m_stdoutBuf : m_stderrBuf;
+        while (true)
+        {
+            std::string_view chunk = buf->readChunk();
+            if (chunk.empty())
+                break;
+            countOutput(stream, chunk.size());
+            m_tail[stream].append(chunk);
+            dispatchOutput(stream, chunk);
+        }
+        onStreamClosed(stream);
+    }
+
+#ifndef _WIN32
+    void ProcessCore::readStreamsMerged()
+    {
+        fd_streambuf *bufs[2] = {m_stdoutBuf, m_stderrBuf};
+        pollfd fds[2] = {{m_stdOutPipe[0], POLLIN, 0}, {m_stdErrPipe[0], POLLIN, 0}};
+        int open = 2;
+        while (open > 0)
+        {
+            if (poll(fds, 2, -1) == -1)
+            {
+                if (errno == EINTR)
                     continue;
-                }
-                else
-                {
-                    std::cout << line << std::endl;
-                }
-            } });
-        outputThread.detach();
-        std::thread errorThread([this]()
-                                {
-            std::string line;
-            while (std::getline(err, line)) {
-                if (m_errorCallback)
+                // Nothing can be read any more, close both streams so the waiters are released.
+                for (pollfd &pfd : fds)
+                    pfd.revents = pfd.fd != -1 ? POLLERR : 0;
+            }
+
+            for (int i = 0; i < 2 && open > 0; ++i)
+            {
+                if (fds[i].fd == -1 || fds[i].revents == 0)
+                    continue;
+                StreamIndex stream = static_cast<StreamIndex>(i);
+                std::string_view chunk = (fds[i].revents & POLLERR) && !(fds[i].revents & POLLIN) ? std::string_view() : bufs[i]->readChunk();
+                if (chunk.empty())
                 {
-                    m_errorCallback(line + '\n');
+                    fds[i].fd = -1;
+                    --open;
+                    // May complete the process, this must not be used after the last one.
+                    onStreamClosed(stream);
                     continue;
                 }
-                else
+                countOutput(stream, chunk.size());
+                m_tail[stream].append(chunk);
+                dispatchOutput(stream, chunk);
+            }
+        }
+    }
+#endif
+
+    void ProcessCore::dispatchOutput(StreamIndex stream, std::string_view chunk)
+    {
+        const OutputChunkCallback &chunkCallback = stream == StdoutIndex ? m_outputChunkCallback : m_errorChunkCallback;
+        if (chunkCallback)
+        {
+            chunkCallback(chunk);
+            return;
+        }
+
+        if (m_outputEventCallback || m_collectOutputEvents)
+            m_readTime[stream] = ProcessStats::Clock::now();
+
+        const RecordFraming &framing = m_framing[stream];
+        if (framing.kind == RecordFraming::Kind::LengthPrefixed)
+        {
+            dispatchLengthPrefixed(stream, chunk);
+            return;
+        }
+
+        std::string &record = m_partialLine[stream];
+        while (!chunk.empty())
+        {
+            const char *end = static_cast<const char *>(std::memchr(chunk.data(), framing.delimiter, chunk.size()));
+            if (!end)
+            {
+                record.append(chunk.data(), chunk.size());
+                break;
+            }
+            size_t length = end - chunk.data() + 1;
+            record.append(chunk.data(), length);
+            chunk.remove_prefix(length);
+            deliverRecord(stream, record);
+        }
+    }
+
+    void ProcessCore::dispatchLengthPrefixed(StreamIndex stream, std::string_view chunk)
+    {
+        const size_t headerSize = 4;
+        std::string &record = m_partialLine[stream]; // the header, then the payload received so far
+
+        while (true)
+        {
+            size_t total = headerSize;
+            if (record.size() >= headerSize)
+            {
+                const unsigned char *header = reinterpret_cast<const unsigned char *>(record.data());
+                uint32_t length = m_framing[stream].bigEndian
+                                      ? uint32_t(header[0]) << 24 | uint32_t(header[1]) << 16 | uint32_t(header[2]) << 8 | header[3]
+                                      : uint32_t(header[3]) << 24 | uint32_t(header[2]) << 16 | uint32_t(header[1]) << 8 | header[0];
+                total += length;
+                if (record.size() == total)
                 {
-                    std::cout << line << std::endl;
+                    record.erase(0, headerSize);
+                    deliverRecord(stream, record);
+                    continue;
                 }
-            } });
-        errorThread.detach();
+            }
+            size_t take = std::min(total - record.size(), chunk.size());
+            if (take == 0)
+                break;
+            record.append(chunk.data(), take);
+            chunk.remove_prefix(take);
+        }
+    }
+
+    void ProcessCore::deliverRecord(StreamIndex stream, std::string &record)
+    {
+        if (m_outputEventCallback || m_collectOutputEvents)
+        {
+            std::lock_guard<std::mutex> lock(m_outputEventMutex);
+            OutputEvent event;
+            event.stream = stream == StdoutIndex ? OutputEvent::Stream::Stdout : OutputEvent::Stream::Stderr;
+            event.time = m_readTime[stream];
+            event.data.swap(record); // handed over without a copy, and back to keep the buffer
+            if (m_outputEventCallback)
+                m_outputEventCallback(event);
+            if (m_collectOutputEvents)
+                m_outputEvents.push_back(std::move(event));
+            else
+                record.swap(event.data);
+            record.clear();
+            return;
+        }
+
+        const OutputLineCallback &callback = stream == StdoutIndex ? m_outputCallback : m_errorCallback;
+        if (stream == StdoutIndex && m_queueOutputLines)
+            queueLine(std::move(record));
+        else if (callback)
+            callback(record);
+        else
+            std::cout << record << std::flush;
+        record.clear();
+    }
+
+    void ProcessCore::onStreamClosed(StreamIndex stream)
+    {
+        // Like std::getline, deliver a last unterminated record. An incomplete length-prefixed one is dropped.
+        if (m_framing[stream].kind == RecordFraming::Kind::LengthPrefixed)
+            m_partialLine[stream].clear();
+        else if (!m_partialLine[stream].empty())
+            dispatchOutput(stream, std::string_view(&m_framing[stream].delimiter, 1));
+
+        bool done;
+        std::function<void()> lineWaiter;
+        {
+            std::lock_guard<std::mutex> lock(m_stateMutex);
+            --m_openStreams;
+            done = !m_running && m_openStreams == 0;
+            if (stream == StdoutIndex)
+            {
+                m_lineQueueClosed = true;
+                lineWaiter.swap(m_lineWaiter);
+            }
+        }
+        if (done)
+            onCompleted();
+        // Resumed last, the coroutine may destroy this object.
+        if (lineWaiter)
+            lineWaiter();
+    }
+
+    void ProcessCore::countOutput(StreamIndex stream, size_t bytes)
+    {
+        if (m_outputBytes[stream] == 0 && bytes > 0)
+            m_firstOutput[stream] = ProcessStats::Clock::now();
+        m_outputBytes[stream] += bytes;
+    }
+
+    void ProcessCore::resetRunState()
+    {
+        m_stats = ProcessStats();
+        m_stats.spawnStarted = ProcessStats::Clock::now();
+        m_outputBytes[StdoutIndex] = m_outputBytes[StderrIndex] = 0;
+        m_firstOutput[StdoutIndex] = m_firstOutput[StderrIndex] = ProcessStats::Clock::time_point();
+        m_inputBytes = 0;
+#ifndef _WIN32
+        m_captureError[StdoutIndex] = m_captureError[StderrIndex] = 0;
+#endif
+        for (int i = 0; i < 2; ++i)
+            m_tail[i].reset(m_tailLimits[i].first, m_tailLimits[i].second);
+        m_outputEvents.clear();
+    }
+
+    ProcessStats ProcessCore::stats() const
+    {
+        ProcessStats stats = m_stats;
+        stats.stdinBytes = m_inputBytes + (m_stdinBuf ? m_stdinBuf->bytesTransferred() : 0);
+        stats.stdoutBytes = m_outputBytes[StdoutIndex];
+        stats.stderrBytes = m_outputBytes[StderrIndex];
+#ifndef _WIN32
+        stats.stdoutCaptureError = m_captureError[StdoutIndex];
+        stats.stderrCaptureError = m_captureError[StderrIndex];
+#endif
+        for (const auto &first : m_firstOutput)
+        {
+            if (first.time_since_epoch().count() != 0 &&
+                (stats.firstOutput.time_since_epoch().count() == 0 || first < stats.firstOutput))
+                stats.firstOutput = first;
+        }
+        return stats;
+    }
+
+    namespace
+    {
+        /** Appends chunk to data up to limit bytes, setting truncated once something was dropped. */
+        void appendLimited(std::string &data, size_t limit, bool &truncated, std::string_view chunk)
+        {
+            size_t room = data.size() < limit ? limit - data.size() : 0;
+            if (chunk.size() > room)
+            {
+                truncated = true;
+                chunk = chunk.substr(0, room);
+            }
+            data.append(chunk.data(), chunk.size());
+        }
+
+        void checkPreparedCommand(const PreparedCommand &cmd, const std::vector<std::string> &slotValues)
+        {
+            if (!cmd.prepared())
+                throw std::runtime_error("Process::start(): PreparedCommand::prepare() was not called");
+            if (slotValues.size() != cmd.slotCount())
+                throw std::invalid_argument("Process::start(): expected " + std::to_string(cmd.slotCount()) +
+                                            " slot values, got " + std::to_string(slotValues.size()));
+        }
     }
 
 #ifdef _WIN32
-    int Process::start()
+    int ProcessCore::start()
     {
+        // The command of this start(), the Process's own settings are left alone for later starts.
+        std::filesystem::path exePath = m_exePath;
+        std::vector<std::string> arguments = m_arguments;
+        std::vector<std::string> environment = m_environment;
+        bool customEnvironment = m_hasCustomEnvironment;
+        if (m_preparedCommand)
+        {
+            // CreateProcess takes a command line and an environment block, built from the prepared strings.
+            checkPreparedCommand(*m_preparedCommand, m_slotValues);
+            std::vector<char *> argv = m_preparedCommand->argv(m_slotValues);
+            exePath = m_preparedCommand->executable();
+            arguments.assign(argv.begin() + 1, argv.end() - 1);
+            environment.clear();
+            for (char *const *var = m_preparedCommand->envp(); *var; ++var)
+                environment.emplace_back(*var);
+            customEnvironment = true;
+        }
+
+        if (m_stdinRedirect.kind != StreamRedirect::Kind::Pipe ||
+            m_stdoutRedirect.kind != StreamRedirect::Kind::Pipe ||
+            m_stderrRedirect.kind != StreamRedirect::Kind::Pipe)
+            throw std::runtime_error("Stream redirection is only supported on POSIX");
+
         SECURITY_ATTRIBUTES saAttr{};
         saAttr.nLength = sizeof(SECURITY_ATTRIBUTES);
         saAttr.bInheritHandle = TRUE;
@@ -198,17 +698,17 @@ namespace cpplib
         if (!m_detached)
         {
             // Create pipes for stdin/out/err
-            if (!CreatePipe(&hStdOutRd, &hStdOutWr, &saAttr, 0))
+            if (!CreatePipe(&hStdOutRd, &hStdOutWr, &saAttr, (DWORD)m_stdoutRedirect.pipeSize))
                 throw std::runtime_error("CreatePipe (stdout) failed");
             if (!SetHandleInformation(hStdOutRd, HANDLE_FLAG_INHERIT, 0))
                 throw std::runtime_error("SetHandleInformation failed (stdout)");
 
-            if (!CreatePipe(&hStdErrRd, &hStdErrWr, &saAttr, 0))
+            if (!CreatePipe(&hStdErrRd, &hStdErrWr, &saAttr, (DWORD)m_stderrRedirect.pipeSize))
                 throw std::runtime_error("CreatePipe (stderr) failed");
             if (!SetHandleInformation(hStdErrRd, HANDLE_FLAG_INHERIT, 0))
                 throw std::runtime_error("SetHandleInformation failed (stderr)");
 
-            if (!CreatePipe(&hStdInRd, &hStdInWr, &saAttr, 0))
+            if (!CreatePipe(&hStdInRd, &hStdInWr, &saAttr, (DWORD)m_stdinRedirect.pipeSize))
                 throw std::runtime_error("CreatePipe (stdin) failed");
             if (!SetHandleInformation(hStdInWr, HANDLE_FLAG_INHERIT, 0))
                 throw std::runtime_error("SetHandleInformation failed (stdin)");
@@ -216,8 +716,8 @@ namespace cpplib
 
         // Build command line (Windows requires a single command string)
         std::wstringstream cmdLine;
-        cmdLine << L"\"" << m_exePath.wstring() << L"\"";
-        for (auto &arg : m_arguments)
+        cmdLine << L"\"" << exePath.wstring() << L"\"";
+        for (auto &arg : arguments)
             cmdLine << L" \"" << std::wstring(arg.begin(), arg.end()) << L"\"";
 
         STARTUPINFOW si{};
@@ -245,7 +745,7 @@ namespace cpplib
         if (m_detached)
         {
             std::wstring parameters;
-            for (auto &arg : m_arguments)
+            for (auto &arg : arguments)
             {
                 if (!parameters.empty())
                     parameters += L" ";
@@ -255,7 +755,7 @@ namespace cpplib
             HINSTANCE result = ShellExecuteW(
                 nullptr,                                           // parent window
                 L"open",                                           // operation
-                m_exePath.wstring().c_str(),                       // file to execute
+                exePath.wstring().c_str(),                       // file to execute
                 parameters.empty() ? nullptr : parameters.c_str(), // parameters
                 workDir.empty() ? nullptr : workDir.c_str(),       // working dir
                 SW_SHOWNORMAL                                      // no visible window
@@ -277,13 +777,14 @@ namespace cpplib
             return 0;
         }
 
+        resetRunState();
         BOOL success = CreateProcessW(
-            m_exePath.wstring().c_str(),
+            exePath.wstring().c_str(),
             cmdLine.str().data(),
             nullptr, nullptr,
             TRUE, // inherit handles
             creationFlags,
-            m_hasCustomEnvironment ? buildEnvironmentBlock() : nullptr,
+            customEnvironment ? buildEnvironmentBlock(environment) : nullptr,
             workDir.empty() ? nullptr : workDir.c_str(),
             &si, &pi);
 
@@ -292,10 +793,10 @@ namespace cpplib
             std::cout << "CreateProcess failed with error: " << GetLastError() << std::endl;
             // print all arguments to stdout for debugging
             std::cout << "CreateProcess arguments: " << cmdLine.str().c_str() << std::endl;
-            std::cout << "Executable path: " << m_exePath.string() << std::endl;
+            std::cout << "Executable path: " << exePath.string() << std::endl;
             std::cout << "Working directory: " << m_workingDirectory << std::endl;
             std::cout << "Environment variables: " << std::endl;
-            for (auto &envVar : m_environment)
+            for (auto &envVar : environment)
             {
                 std::cout << envVar << std::endl;
             }
@@ -307,9 +808,14 @@ namespace cpplib
         CloseHandle(hStdErrWr);
         CloseHandle(hStdInRd);
 
+        m_stats.execCompleted = ProcessStats::Clock::now();
         m_processHandle = pi.hProcess;
         m_threadHandle = pi.hThread;
         m_pid = pi.dwProcessId;
+        m_completed = false;
+        m_openStreams = 2;
+        m_lineQueue.clear();
+        m_lineQueueClosed = false;
         m_running = true;
 
         if (m_stdoutBuf)
@@ -320,27 +826,25 @@ namespace cpplib
             delete m_stdinBuf;
 
         // Attach streams
-        m_stdoutBuf = new fd_streambuf(hStdOutRd, true);
-        out.rdbuf(m_stdoutBuf);
-        m_stderrBuf = new fd_streambuf(hStdErrRd, true);
-        err.rdbuf(m_stderrBuf);
-        m_stdinBuf = new fd_streambuf(hStdInWr, false);
-        in.rdbuf(m_stdinBuf);
+        m_stdoutBuf = new fd_streambuf(hStdOutRd, true, m_stdoutRedirect.bufferSize);
+        m_out->rdbuf(m_stdoutBuf);
+        m_stderrBuf = new fd_streambuf(hStdErrRd, true, m_stderrRedirect.bufferSize);
+        m_err->rdbuf(m_stderrBuf);
+        m_stdinBuf = new fd_streambuf(hStdInWr, false, m_stdinRedirect.bufferSize);
+        m_in->rdbuf(m_stdinBuf);
 
         // Start monitor thread
-        m_monitorThread = std::thread(std::bind(&Process::monitorProcess, this));
+        m_monitorThread = std::thread(std::bind(&ProcessCore::monitorProcess, this));
 
         startIOThreads();
 
         return 0;
     }
 
-    wchar_t *Process::buildEnvironmentBlock()
+    wchar_t *ProcessCore::buildEnvironmentBlock(const std::vector<std::string> &environment)
     {
-        if (!m_hasCustomEnvironment)
-            return nullptr;
         std::wstring envBlock;
-        for (auto &kv : m_environment)
+        for (auto &kv : environment)
         {
             envBlock += std::wstring(kv.begin(), kv.end());
             envBlock += L'\0';
@@ -351,39 +855,70 @@ namespace cpplib
         return envPtr;
     }
 
-    void Process::monitorProcess()
+    void ProcessCore::monitorProcess()
     {
         WaitForSingleObject(m_processHandle, INFINITE);
 
+        // FILETIMEs count 100ns units.
+        FILETIME creationTime, exitTime, kernelTime, userTime;
+        if (GetProcessTimes(m_processHandle, &creationTime, &exitTime, &kernelTime, &userTime))
+        {
+            auto toMicroseconds = [](const FILETIME &time)
+            {
+                ULARGE_INTEGER value;
+                value.LowPart = time.dwLowDateTime;
+                value.HighPart = time.dwHighDateTime;
+                return std::chrono::microseconds(value.QuadPart / 10);
+            };
+            m_stats.userTime = toMicroseconds(userTime);
+            m_stats.systemTime = toMicroseconds(kernelTime);
+        }
+
         DWORD exitCode;
         if (GetExitCodeProcess(m_processHandle, &exitCode))
-            m_exitCode = exitCode;
+            onProcessExit(exitCode);
         else
-            m_exitCode = -1;
+            onProcessExit(-1);
+    }
 
-        onProcessExit();
+    void ProcessCore::closeInput()
+    {
+        if (m_stdinBuf)
+            m_stdinBuf->sync();
+        if (m_stdInPipeOpen)
+        {
+            CloseHandle(hStdInWr);
+            m_stdInPipeOpen = false;
+        }
     }
 
-    int Process::waitForExit()
+    int ProcessCore::waitForExit()
     {
-        if (m_detached || !m_running)
+        if (m_detached || m_pid == -1)
             return -1;
 
-        WaitForSingleObject(m_processHandle, INFINITE);
+        closeInput();
 
-        DWORD exitCode;
-        if (GetExitCodeProcess(m_processHandle, &exitCode))
-            m_exitCode = exitCode;
+        {
+            std::unique_lock<std::mutex> lock(m_stateMutex);
+            m_exitCondition.wait(lock, [this]
+                                 { return m_completed; });
+        }
+        joinThreads();
 
-        CloseHandle(m_processHandle);
-        CloseHandle(m_threadHandle);
+        if (m_processHandle != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(m_processHandle);
+            CloseHandle(m_threadHandle);
+            m_processHandle = INVALID_HANDLE_VALUE;
+            m_threadHandle = INVALID_HANDLE_VALUE;
+        }
         closePipes();
 
-        m_running = false;
         return m_exitCode;
     }
 
-    void Process::closePipes()
+    void ProcessCore::closePipes()
     {
         if (m_stdOutPipeOpen)
         {
@@ -401,111 +936,315 @@ namespace cpplib
             m_stdInPipeOpen = false;
         }
     }
-#else
-    int Process::start()
+
+    CommunicateResult ProcessCore::communicate(std::string_view input, const CommunicateOptions &options)
     {
-        std::vector<std::string> argv_vec;
-        argv_vec.push_back(m_exePath.string());
-        argv_vec.insert(argv_vec.end(), m_arguments.begin(), m_arguments.end());
+        CommunicateResult result;
+        result.output.reserve(options.outputReserve);
+        result.error.reserve(options.errorReserve);
+
+        // Anonymous pipes cannot be polled here: the IO threads read while this thread writes stdin.
+        OutputChunkCallback outputCallback = m_outputChunkCallback;
+        OutputChunkCallback errorCallback = m_errorChunkCallback;
+        m_outputChunkCallback = [&](std::string_view chunk)
+        { appendLimited(result.output, options.maxOutputSize, result.outputTruncated, chunk); };
+        m_errorChunkCallback = [&](std::string_view chunk)
+        { appendLimited(result.error, options.maxErrorSize, result.errorTruncated, chunk); };
+
+        try
+        {
+            start();
+            m_in->write(input.data(), input.size());
+            result.exitCode = waitForExit();
+        }
+        catch (...)
+        {
+            m_outputChunkCallback = outputCallback;
+            m_errorChunkCallback = errorCallback;
+            throw;
+        }
+        m_outputChunkCallback = outputCallback;
+        m_errorChunkCallback = errorCallback;
+        return result;
+    }
 
-        char *const *argv = buildArgvArray(argv_vec);
-        char *const *envp = buildArgvArray(m_environment);
+    bool ProcessCore::sendSignal(int signal, bool processGroup)
+    {
+        (void)signal;
+        (void)processGroup;
+        // No signals on Windows, every request ends the process.
+        if (m_detached || !m_running || m_processHandle == INVALID_HANDLE_VALUE)
+            return false;
+        return TerminateProcess(m_processHandle, 1);
+    }
+#else
+    using detail::ChildSpec;
+    using detail::makePipe;
+    using detail::spawnChild;
+    using detail::FdMapping;
+    using detail::liftFdMappings;
 
-        if (!m_detached)
+    namespace
+    {
+        int decodeWaitStatus(int status)
+        {
+            if (WIFEXITED(status))
+                return WEXITSTATUS(status);
+            if (WIFSIGNALED(status))
+                return 128 + WTERMSIG(status);
+            return -1;
+        }
+
+        int openPidfd(pid_t pid)
         {
-            if (pipe(m_stdOutPipe) == -1)
+#if defined(__linux__) && defined(SYS_pidfd_open)
+            return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+            (void)pid;
+            return -1;
+#endif
+        }
+        int openRedirectFile(const StreamRedirect &redirect, bool input, bool null)
+        {
+            std::string path = null ? std::string("/dev/null") : redirect.path.string();
+            int flags = O_CLOEXEC;
+            if (null)
+                flags |= O_RDWR;
+            else if (input)
+                flags |= O_RDONLY;
+            else
+                flags |= O_WRONLY | O_CREAT | (redirect.append ? O_APPEND : O_TRUNC);
+
+            int fd = open(path.c_str(), flags, 0644);
+            if (fd == -1)
+                throw std::runtime_error("Process::start(): cannot open " + path + ": " + std::strerror(errno));
+            return fd;
+        }
+
+        bool writeAll(int fd, const char *data, size_t size)
+        {
+            while (size > 0)
             {
-                freeArgvArray(argv);
-                freeArgvArray(envp);
-                throw std::runtime_error("pipe() failed");
-                return -1;
+                ssize_t written = ::write(fd, data, size);
+                if (written == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                data += written;
+                size -= written;
             }
-            m_stdOutPipeOpen[0] = true;
-            m_stdOutPipeOpen[1] = true;
+            return true;
+        }
+    }
+
+    int ProcessCore::start()
+    {
+        char *const *argv = nullptr;
+        char *const *envp = nullptr;
+        std::vector<char *> preparedArgv;
 
-            if (pipe(m_stdErrPipe) == -1)
+        ChildSpec spec;
+        if (m_preparedCommand)
+        {
+            checkPreparedCommand(*m_preparedCommand, m_slotValues);
+            preparedArgv = m_preparedCommand->argv(m_slotValues);
+            spec.argv = preparedArgv.data();
+            spec.executable = m_preparedCommand->executable().c_str();
+            spec.envp = m_preparedCommand->envp();
+            spec.customEnvironment = true;
+        }
+        else
+        {
+            std::vector<std::string> argv_vec;
+            argv_vec.push_back(m_exePath.string());
+            argv_vec.insert(argv_vec.end(), m_arguments.begin(), m_arguments.end());
+
+            argv = buildArgvArray(argv_vec);
+            spec.argv = argv;
+            if (m_hasCustomEnvironment)
             {
-                freeArgvArray(argv);
-                freeArgvArray(envp);
-                throw std::runtime_error("pipe() failed");
-                return -1;
+                envp = buildArgvArray(m_environment);
+                spec.envp = envp;
+                spec.customEnvironment = true;
             }
-            m_stdErrPipeOpen[0] = true;
-            m_stdErrPipeOpen[1] = true;
-
-            if (pipe(m_stdInPipe) == -1)
+        }
+        std::vector<FdMapping> fdMappings;
+        for (const auto &mapping : m_fdMappings)
+            fdMappings.push_back({mapping.first, mapping.second});
+#ifdef __linux__
+        // Shared rings stay open in the child, which finds their fd numbers in its environment.
+        std::vector<std::string> ringVariables;
+        std::vector<char *> ringEnvp;
+        if (!m_sharedRings.empty())
+        {
+            for (const auto &ring : m_sharedRings)
             {
-                freeArgvArray(argv);
-                freeArgvArray(envp);
-                throw std::runtime_error("pipe() failed");
-                return -1;
+                ringVariables.push_back(ring.first + "=" + std::to_string(ring.second));
+                fdMappings.push_back({ring.second, ring.second});
+            }
+            for (char *const *var = spec.envp ? spec.envp : environ; var && *var; ++var)
+            {
+                bool replaced = false;
+                for (const auto &ring : m_sharedRings)
+                    replaced = replaced || (std::strncmp(*var, ring.first.c_str(), ring.first.size()) == 0 && (*var)[ring.first.size()] == '=');
+                if (!replaced)
+                    ringEnvp.push_back(*var);
             }
-            m_stdInPipeOpen[0] = true;
-            m_stdInPipeOpen[1] = true;
+            for (std::string &variable : ringVariables)
+                ringEnvp.push_back(&variable[0]);
+            ringEnvp.push_back(nullptr);
+            spec.envp = ringEnvp.data();
         }
+#endif
+        spec.workingDirectory = m_workingDirectory.empty() ? nullptr : m_workingDirectory.c_str();
+        spec.newSession = m_detached;
+        spec.processGroup = m_newProcessGroup ? 0 : -1;
 
-        pid_t pid = fork();
-        if (pid == -1)
+        // Fds only needed until the child is spawned (files, /dev/null).
+        std::vector<int> spawnFds;
+        auto cleanup = [&]()
         {
             freeArgvArray(argv);
             freeArgvArray(envp);
+            for (int fd : spawnFds)
+                close(fd);
             closePipes();
-            throw std::runtime_error("fork() failed");
-            return -1;
-        }
-        else if (pid == 0)
+        };
+
+        // Returns the fd to dup onto the child's stream, -1 to keep the parent's.
+        auto prepareStream = [&](const StreamRedirect &redirect, int pipeFd[2], bool pipeOpen[2], bool input) -> int
         {
-            // Child process
-            if (m_detached)
+            StreamRedirect::Kind kind = redirect.kind;
+            if (m_detached && kind == StreamRedirect::Kind::Pipe)
+                kind = StreamRedirect::Kind::Null;
+
+            switch (kind)
             {
-                // Detach from controlling terminal / session
-                setsid();
-                // Redirect stdin/out/err to /dev/null to avoid tying to parent's fds.
-                int fd = open("/dev/null", O_RDWR);
-                if (fd != -1)
-                {
-                    dup2(fd, STDIN_FILENO);
-                    dup2(fd, STDOUT_FILENO);
-                    dup2(fd, STDERR_FILENO);
-                    if (fd > 2)
-                        close(fd);
-                }
+            case StreamRedirect::Kind::Pipe:
+            case StreamRedirect::Kind::CaptureToFile:
+                if (input && kind == StreamRedirect::Kind::CaptureToFile)
+                    throw std::invalid_argument("CaptureToFile is only valid for stdout/stderr");
+                if (makePipe(pipeFd) == -1)
+                    throw std::runtime_error("pipe() failed");
+                pipeOpen[0] = true;
+                pipeOpen[1] = true;
+#ifdef F_SETPIPE_SZ
+                // Best effort, an unprivileged process cannot go beyond /proc/sys/fs/pipe-max-size.
+                if (redirect.pipeSize > 0)
+                    fcntl(pipeFd[0], F_SETPIPE_SZ, static_cast<int>(std::min<size_t>(redirect.pipeSize, INT_MAX)));
+#endif
+                return input ? pipeFd[0] : pipeFd[1];
+            case StreamRedirect::Kind::Inherit:
+                return -1;
+            case StreamRedirect::Kind::Fd:
+                return redirect.fd;
+            case StreamRedirect::Kind::Null:
+            case StreamRedirect::Kind::File:
+                break;
             }
-            else
+            int fd = openRedirectFile(redirect, input, kind == StreamRedirect::Kind::Null);
+            spawnFds.push_back(fd);
+            return fd;
+        };
+
+        pid_t pid;
+        try
+        {
+            spec.stdinFd = prepareStream(m_stdinRedirect, m_stdInPipe, m_stdInPipeOpen, true);
+            spec.stdoutFd = prepareStream(m_stdoutRedirect, m_stdOutPipe, m_stdOutPipeOpen, false);
+            spec.stderrFd = prepareStream(m_stderrRedirect, m_stdErrPipe, m_stdErrPipeOpen, false);
+
+#ifdef __linux__
+            // Opened before the mappings are lifted, which must not reuse its number.
+            if (!m_cgroup.empty())
             {
-                // Redirect stdout to pipe
-                CLOSE_PIPE(Out, 0);
-                CLOSE_PIPE(Err, 0);
-                CLOSE_PIPE(In, 1);
-                dup2(m_stdOutPipe[1], STDOUT_FILENO);
-                dup2(m_stdErrPipe[1], STDERR_FILENO);
-                dup2(m_stdInPipe[0], STDIN_FILENO);
+                std::filesystem::path procs = m_cgroup / "cgroup.procs";
+                int fd = open(procs.c_str(), O_WRONLY | O_CLOEXEC);
+                if (fd == -1)
+                    throw std::runtime_error("Process::start(): cannot open " + procs.string() + ": " + std::strerror(errno));
+                spawnFds.push_back(fd);
+                spec.cgroupProcsFd = fd;
+            }
+#endif
+            liftFdMappings(fdMappings, {spec.stdinFd, spec.stdoutFd, spec.stderrFd, spec.cgroupProcsFd}, spawnFds);
+            if (spec.cgroupProcsFd != -1)
+                spec.cgroupProcsFd = detail::liftAboveTargets(spec.cgroupProcsFd, fdMappings, spawnFds);
+            spec.fdMappings = fdMappings.data();
+            spec.fdMappingCount = fdMappings.size();
+            spec.closeOtherFds = m_closeOtherFds;
+
+            if (m_nice)
+            {
+                spec.limits.setNice = 1;
+                spec.limits.nice = *m_nice;
             }
+            spec.resourceLimits = m_resourceLimits.data();
+            spec.limits.resourceLimitCount = static_cast<uint32_t>(m_resourceLimits.size());
+#ifdef __linux__
+            for (int cpu : m_cpuAffinity)
+            {
+                if (cpu < 0 || cpu >= CPU_SETSIZE)
+                    throw std::invalid_argument("Process::start(): CPU " + std::to_string(cpu) + " is out of range");
+            }
+            spec.cpus = m_cpuAffinity.data();
+            spec.limits.cpuCount = static_cast<uint32_t>(m_cpuAffinity.size());
+            if (m_schedulingPolicy != SchedulingPolicy::Inherit)
+                spec.limits.schedulingPolicy = m_schedulingPolicy == SchedulingPolicy::Batch ? SCHED_BATCH : SCHED_IDLE;
+            if (m_ioPriorityClass != IoPriorityClass::Inherit)
+            {
+                // IOPRIO_PRIO_VALUE(class, level) with IOPRIO_CLASS_BE = 2 and IOPRIO_CLASS_IDLE = 3.
+                bool bestEffort = m_ioPriorityClass == IoPriorityClass::BestEffort;
+                spec.limits.ioPriority = ((bestEffort ? 2 : 3) << 13) | (bestEffort ? std::clamp(m_ioPriorityLevel, 0, 7) : 0);
+            }
+#endif
 
-            if (!m_workingDirectory.empty())
+            const StreamRedirect *outputRedirects[2] = {&m_stdoutRedirect, &m_stderrRedirect};
+            for (int i = 0; i < 2; ++i)
             {
-                chdir(m_workingDirectory.c_str());
+                m_capturing[i] = !m_detached && outputRedirects[i]->kind == StreamRedirect::Kind::CaptureToFile;
+                m_captureSplice[i] = m_capturing[i];
+                if (m_capturing[i])
+                    m_captureFd[i] = openRedirectFile(*outputRedirects[i], false, false);
             }
 
-            if (m_hasCustomEnvironment)
-                execve(argv[0], argv, envp);
-            else
-                execvp(argv[0], argv);
+            resetRunState();
+            pid = spawnChild(spec, m_spawnBackend);
+            m_stats.execCompleted = ProcessStats::Clock::now();
+        }
+        catch (...)
+        {
+            cleanup();
+            throw;
+        }
 
-            // If execvp returns, it failed — clean up before exiting
-            freeArgvArray(argv);
-            freeArgvArray(envp);
-            _exit(127);
+        // Parent process
+        freeArgvArray(argv);
+        freeArgvArray(envp);
+        for (int fd : spawnFds)
+            close(fd);
+
+        m_pid = pid;
+
+        if (m_detached)
+        {
+            // The child runs in its own session, it is not monitored, only reaped once it exits.
+            std::thread([pid]()
+                        {
+                int status;
+                while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+                    ; })
+                .detach();
+            m_running = false;
+            m_exitCode = 0;
+            return 0;
         }
 
         CLOSE_PIPE(Out, 1);
         CLOSE_PIPE(Err, 1);
         CLOSE_PIPE(In, 0);
 
-        // Parent process
-        freeArgvArray(argv);
-        freeArgvArray(envp);
-
         if (m_stdoutBuf)
             delete m_stdoutBuf;
         if (m_stderrBuf)
@@ -513,26 +1252,63 @@ namespace cpplib
         if (m_stdinBuf)
             delete m_stdinBuf;
 
-        m_stdoutBuf = new fd_streambuf(m_stdOutPipe[0], true);
-        out.rdbuf(m_stdoutBuf);
+        m_stdoutBuf = nullptr;
+        m_stderrBuf = nullptr;
+        m_stdinBuf = nullptr;
 
-        m_stderrBuf = new fd_streambuf(m_stdErrPipe[0], true);
-        err.rdbuf(m_stderrBuf);
+        if (m_stdOutPipeOpen[0])
+        {
+            m_stdoutBuf = new fd_streambuf(m_stdOutPipe[0], true, m_stdoutRedirect.bufferSize);
+            m_out->rdbuf(m_stdoutBuf);
+        }
 
-        m_stdinBuf = new fd_streambuf(m_stdInPipe[1], false);
-        in.rdbuf(m_stdinBuf);
+        if (m_stdErrPipeOpen[0])
+        {
+            m_stderrBuf = new fd_streambuf(m_stdErrPipe[0], true, m_stderrRedirect.bufferSize);
+            m_err->rdbuf(m_stderrBuf);
+        }
 
-        m_pid = pid;
+        if (m_stdInPipeOpen[1])
+        {
+            m_stdinBuf = new fd_streambuf(m_stdInPipe[1], false, m_stdinRedirect.bufferSize);
+            m_in->rdbuf(m_stdinBuf);
+        }
+
+        m_pidfd = openPidfd(pid);
+        m_completed = false;
+        m_openStreams = (m_stdoutBuf ? 1 : 0) + (m_stderrBuf ? 1 : 0);
+        m_lineQueue.clear();
+        m_lineQueueClosed = !m_stdoutBuf;
         m_running = true;
 
-        m_monitorThread = std::thread(std::bind(&Process::monitorProcess, this));
+        if (m_manualIO)
+            return 0;
+
+        if (m_reactor)
+        {
+            m_reactor->attach(this);
+            return 0;
+        }
+
+        m_monitorThread = std::thread(std::bind(&ProcessCore::monitorProcess, this));
 
         startIOThreads();
 
         return 0;
     }
 
-    int Process::waitForExit()
+    void ProcessCore::closeInput()
+    {
+        // Let the child see EOF on its stdin.
+        if (m_stdinBuf)
+        {
+            m_stdinBuf->sync();
+            m_in->rdbuf(nullptr);
+        }
+        CLOSE_PIPE(In, 1);
+    }
+
+    int ProcessCore::waitForExit()
     {
         if (m_detached)
         {
@@ -544,73 +1320,344 @@ namespace cpplib
             return -1;
         }
 
-        if (m_stdoutBuf)
+        closeInput();
+
         {
-            m_stdoutBuf->sync();
+            std::unique_lock<std::mutex> lock(m_stateMutex);
+            m_exitCondition.wait(lock, [this]
+                                 { return m_completed; });
         }
-        if (m_stderrBuf)
+
+        // The output is drained once the child's end of the pipes is closed.
+        joinThreads();
+
+        closePipes();
+        if (m_pidfd != -1)
         {
-            m_stderrBuf->sync();
+            close(m_pidfd);
+            m_pidfd = -1;
         }
+
+        return m_exitCode;
+    }
+
+    bool ProcessCore::sendSignal(int signal, bool processGroup)
+    {
+        if (m_detached || m_pid == -1)
+            return false;
+        // The group outlives its leader while other members remain, its id cannot be reused until then.
+        if (processGroup && m_newProcessGroup)
+            return ::kill(-m_pid, signal) == 0;
+        if (!m_running)
+            return false;
+#if defined(__linux__) && defined(SYS_pidfd_send_signal)
+        // Immune to pid reuse: the pidfd keeps referring to our child even once it is reaped.
+        if (m_pidfd != -1 && syscall(SYS_pidfd_send_signal, m_pidfd, signal, nullptr, 0) == 0)
+            return true;
+        if (m_pidfd != -1 && errno != ENOSYS)
+            return false;
+#endif
+        return ::kill(m_pid, signal) == 0;
+    }
+
+    CommunicateResult ProcessCore::communicate(std::string_view input, const CommunicateOptions &options)
+    {
+        if (m_detached)
+            throw std::invalid_argument("Process::communicate(): not available for detached processes");
+        if (!input.empty() && m_stdinRedirect.kind != StreamRedirect::Kind::Pipe)
+            throw std::invalid_argument("Process::communicate(): input given but stdin is not a pipe");
+
+        CommunicateResult result;
+        result.output.reserve(options.outputReserve);
+        result.error.reserve(options.errorReserve);
+
+        m_manualIO = true;
+        try
+        {
+            start();
+        }
+        catch (...)
+        {
+            m_manualIO = false;
+            throw;
+        }
+        m_manualIO = false;
+
+        // stdin is written directly, never through `in`.
         if (m_stdinBuf)
         {
-            m_stdinBuf->sync();
+            m_in->rdbuf(nullptr);
+            delete m_stdinBuf;
+            m_stdinBuf = nullptr;
+        }
+        int inputFd = -1;
+        if (m_stdInPipeOpen[1])
+        {
+            if (input.empty())
+            {
+                CLOSE_PIPE(In, 1);
+            }
+            else
+            {
+                inputFd = m_stdInPipe[1];
+                fcntl(inputFd, F_SETFL, fcntl(inputFd, F_GETFL) | O_NONBLOCK);
+            }
         }
 
-        closePipes();
+        bool streamOpen[2] = {m_stdoutBuf != nullptr, m_stderrBuf != nullptr};
+        fd_streambuf *bufs[2] = {m_stdoutBuf, m_stderrBuf};
+        int streamFds[2] = {m_stdOutPipe[0], m_stdErrPipe[0]};
+        std::string *data[2] = {&result.output, &result.error};
+        size_t limits[2] = {options.maxOutputSize, options.maxErrorSize};
+        bool *truncated[2] = {&result.outputTruncated, &result.errorTruncated};
 
-        if (!m_running)
+        sigset_t pipeSignal;
+        sigemptyset(&pipeSignal);
+        sigaddset(&pipeSignal, SIGPIPE);
+
+        int pollError = 0;
+        while (inputFd != -1 || streamOpen[0] || streamOpen[1])
         {
-            return m_exitCode;
+            pollfd fds[3];
+            int watched[3];
+            nfds_t count = 0;
+            if (inputFd != -1)
+            {
+                fds[count] = pollfd{inputFd, POLLOUT, 0};
+                watched[count++] = -1;
+            }
+            for (int i = 0; i < 2; ++i)
+            {
+                if (streamOpen[i])
+                {
+                    fds[count] = pollfd{streamFds[i], POLLIN, 0};
+                    watched[count++] = i;
+                }
+            }
+
+            if (poll(fds, count, -1) == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                // Reported once the child is reaped, so the Process is left finished rather than half-driven.
+                pollError = errno;
+                if (inputFd != -1)
+                    CLOSE_PIPE(In, 1);
+                inputFd = -1;
+                for (int i = 0; i < 2; ++i)
+                {
+                    if (streamOpen[i])
+                    {
+                        streamOpen[i] = false;
+                        onStreamClosed(static_cast<StreamIndex>(i));
+                    }
+                }
+                break;
+            }
+
+            for (nfds_t i = 0; i < count; ++i)
+            {
+                if (!fds[i].revents)
+                    continue;
+
+                if (watched[i] == -1)
+                {
+                    // Blocked so that a child that stops reading gives EPIPE instead of killing us.
+                    sigset_t oldMask, pending;
+                    pthread_sigmask(SIG_BLOCK, &pipeSignal, &oldMask);
+                    sigpending(&pending);
+                    bool alreadyPending = sigismember(&pending, SIGPIPE);
+
+                    ssize_t written = ::write(inputFd, input.data(), input.size());
+                    int writeErrno = errno;
+                    if (written == -1 && writeErrno == EPIPE && !alreadyPending)
+                    {
+                        timespec zero{0, 0};
+                        sigtimedwait(&pipeSignal, nullptr, &zero);
+                    }
+                    pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+
+                    if (written > 0)
+                    {
+                        input.remove_prefix(written);
+                        m_inputBytes += written;
+                    }
+                    bool failed = written == -1 && writeErrno != EAGAIN && writeErrno != EINTR;
+                    if (input.empty() || failed)
+                    {
+                        CLOSE_PIPE(In, 1);
+                        inputFd = -1;
+                    }
+                    continue;
+                }
+
+                StreamIndex stream = static_cast<StreamIndex>(watched[i]);
+                bool closed;
+                if (m_capturing[stream])
+                {
+                    closed = transferCapture(stream, true) == 0;
+                }
+                else
+                {
+                    std::string_view chunk = bufs[stream]->readChunk();
+                    closed = chunk.empty() && bufs[stream]->atEof();
+                    countOutput(stream, chunk.size());
+                    m_tail[stream].append(chunk);
+                    appendLimited(*data[stream], limits[stream], *truncated[stream], chunk);
+                }
+                if (closed)
+                {
+                    streamOpen[stream] = false;
+                    onStreamClosed(stream);
+                }
+            }
         }
 
-        int status = 0;
-        waitpid(m_pid, &status, 0);
-        m_running = false;
+        int exitCode = -1;
+        reapChild(m_pid, m_pidfd, true, exitCode, &m_stats);
+        onProcessExit(exitCode);
+        result.exitCode = waitForExit();
+        if (pollError)
+            throw std::runtime_error(std::string("Process::communicate(): poll() failed: ") + std::strerror(pollError));
+        return result;
+    }
 
-        if (WIFEXITED(status))
-            m_exitCode = WEXITSTATUS(status);
-        else if (WIFSIGNALED(status))
-            m_exitCode = 128 + WTERMSIG(status);
-        return m_exitCode;
+    namespace
+    {
+        void recordUsage(ProcessStats *stats, const rusage &usage)
+        {
+            if (!stats)
+                return;
+            auto toMicroseconds = [](const timeval &time)
+            {
+                return std::chrono::microseconds(static_cast<int64_t>(time.tv_sec) * 1000000 + time.tv_usec);
+            };
+            stats->userTime = toMicroseconds(usage.ru_utime);
+            stats->systemTime = toMicroseconds(usage.ru_stime);
+            stats->maxResidentKb = usage.ru_maxrss;
+            stats->minorFaults = usage.ru_minflt;
+            stats->majorFaults = usage.ru_majflt;
+            stats->voluntaryContextSwitches = usage.ru_nvcsw;
+            stats->involuntaryContextSwitches = usage.ru_nivcsw;
+        }
     }
 
-    void Process::monitorProcess()
+    bool ProcessCore::reapChild(pid_t pid, int pidfd, bool block, int &exitCode, ProcessStats *stats)
     {
-        int status;
-        while (m_running)
+        rusage usage{};
+#ifdef __linux__
+        if (pidfd != -1)
         {
-            pid_t result = waitpid(m_pid, &status, WNOHANG);
+            // P_PIDFD (Linux 5.4+), not yet in every libc's idtype_t. The raw syscall also
+            // returns the child's rusage, which the libc wrapper does not expose.
+            siginfo_t info{};
+            long result;
+            do
+                result = syscall(SYS_waitid, 3, pidfd, &info, WEXITED | (block ? 0 : WNOHANG), &usage);
+            while (result == -1 && errno == EINTR);
+
             if (result == 0)
             {
-                // Still running
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                if (info.si_pid == 0)
+                    return false; // WNOHANG and still running
+                exitCode = info.si_code == CLD_EXITED ? info.si_status : 128 + info.si_status;
+                recordUsage(stats, usage);
+                return true;
             }
-            else if (result == m_pid)
+            if (errno != EINVAL)
             {
-                if (WIFEXITED(status))
-                    m_exitCode = WEXITSTATUS(status);
-                else if (WIFSIGNALED(status))
-                    m_exitCode = 128 + WTERMSIG(status);
-                onProcessExit();
-                break;
-            }
-            else
-            {
-                perror("waitpid failed");
-                break;
+                // E.g. ECHILD when the host reaped the child itself, the exit code is lost.
+                exitCode = -1;
+                return true;
             }
+            // Kernel without P_PIDFD support, fall back to wait4.
         }
+#else
+        (void)pidfd;
+#endif
+        int status = 0;
+        pid_t result;
+        do
+            result = wait4(pid, &status, block ? 0 : WNOHANG, &usage);
+        while (result == -1 && errno == EINTR);
+
+        if (result == 0)
+            return false;
+        if (result == pid)
+        {
+            exitCode = decodeWaitStatus(status);
+            recordUsage(stats, usage);
+            return true;
+        }
+        exitCode = -1;
+        return true;
+    }
+
+    void ProcessCore::monitorProcess()
+    {
+        int exitCode = -1;
+        reapChild(m_pid, m_pidfd, true, exitCode, &m_stats);
+        onProcessExit(exitCode);
     }
 
-    void Process::closePipes()
+    void ProcessCore::closePipes()
     {
         closePipe(m_stdOutPipe, m_stdOutPipeOpen);
         closePipe(m_stdErrPipe, m_stdErrPipeOpen);
         closePipe(m_stdInPipe, m_stdInPipeOpen);
+        for (int &fd : m_captureFd)
+        {
+            if (fd != -1)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
     }
 
-    void Process::closePipe(int pipeFd[2], bool openFlags[2], int endsToClose)
+    ssize_t ProcessCore::transferCapture(StreamIndex stream, bool nonBlocking)
+    {
+        int from = stream == StdoutIndex ? m_stdOutPipe[0] : m_stdErrPipe[0];
+        int &to = m_captureFd[stream];
+#ifdef __linux__
+        if (to != -1 && m_captureSplice[stream])
+        {
+            ssize_t moved;
+            do
+                moved = splice(from, nullptr, to, nullptr, 1 << 20, SPLICE_F_MOVE | (nonBlocking ? SPLICE_F_NONBLOCK : 0));
+            while (moved == -1 && errno == EINTR);
+
+            if (moved >= 0)
+            {
+                countOutput(stream, moved);
+                return moved;
+            }
+            if (errno == EAGAIN)
+                return -1;
+            // E.g. EINVAL when the target does not support splice (O_APPEND on older kernels): copy instead,
+            // the write below records the errors the file itself has.
+            m_captureSplice[stream] = false;
+        }
+#else
+        (void)from;
+        (void)nonBlocking;
+#endif
+        // Copy fallback, also drains and discards the data once writing to the file failed.
+        fd_streambuf *buf = stream == StdoutIndex ? m_stdoutBuf : m_stderrBuf;
+        std::string_view chunk = buf->readChunk();
+        if (chunk.empty())
+            return buf->atEof() ? 0 : -1;
+        countOutput(stream, chunk.size());
+        if (to != -1 && !writeAll(to, chunk.data(), chunk.size()))
+        {
+            m_captureError[stream] = errno;
+            close(to);
+            to = -1;
+        }
+        return static_cast<ssize_t>(chunk.size());
+    }
+
+    void ProcessCore::closePipe(int pipeFd[2], bool openFlags[2], int endsToClose)
     {
         if (endsToClose == 3)
         {
@@ -640,35 +1687,35 @@ namespace cpplib
         }
     }
 
-    char *const *Process::buildArgvArray(const std::vector<std::string> &argv) const
+    char *const *ProcessCore::buildArgvArray(const std::vector<std::string> &argv) const
     {
-        // Allocate array of char* (size + 1 for null terminator)
-        char **argArray = new char *[argv.size() + 1];
-
+        // One allocation: the pointer array (with its null terminator) followed by the strings.
+        size_t size = (argv.size() + 1) * sizeof(char *);
+        for (const std::string &arg : argv)
+            size += arg.size() + 1;
+
+        char **argArray = static_cast<char **>(std::malloc(size));
+        if (!argArray)
+            throw std::bad_alloc();
+        char *next = reinterpret_cast<char *>(argArray + argv.size() + 1);
         for (size_t i = 0; i < argv.size(); ++i)
         {
-            // Duplicate string data (so lifetime is independent of std::string)
-            argArray[i] = strdup(argv[i].c_str());
+            argArray[i] = next;
+            std::memcpy(next, argv[i].c_str(), argv[i].size() + 1);
+            next += argv[i].size() + 1;
         }
 
         argArray[argv.size()] = nullptr; // NULL terminator
         return argArray;
     }
 
-    void Process::freeArgvArray(char *const *argv) const
+    void ProcessCore::freeArgvArray(char *const *argv) const
     {
-        if (!argv)
-            return;
-
-        for (size_t i = 0; argv[i] != nullptr; ++i)
-        {
-            free(const_cast<char *>(argv[i]));
-        }
-        delete[] argv;
+        std::free(const_cast<char **>(argv));
     }
 #endif
 
-    int Process::run()
+    int ProcessCore::run()
     {
         if (start())
         {
@@ -693,7 +1740,53 @@ namespace cpplib
         return 0;
     }
 
-    std::vector<std::string> Process::buildArgv(const std::string &cmd) const
+    int ProcessCore::run(std::chrono::milliseconds timeout, const TerminationPolicy &policy)
+    {
+        if (start())
+            return -1;
+        if (m_detached)
+            return 0;
+
+        // Nothing can be written to stdin from here, let the child see EOF like run() does.
+        closeInput();
+        if (waitUntil(std::chrono::steady_clock::now() + timeout))
+            return 0;
+        terminate(policy);
+        return -1;
+    }
+
+    std::optional<int> ProcessCore::waitUntil(std::chrono::steady_clock::time_point deadline)
+    {
+        if (m_detached || m_pid == -1)
+            return -1;
+
+        {
+            // Woken by the completion path, no polling while the child runs. stdin stays open until the
+            // exit is seen, so a caller that times out can keep feeding the process.
+            std::unique_lock<std::mutex> lock(m_stateMutex);
+            if (!m_exitCondition.wait_until(lock, deadline, [this]
+                                            { return m_completed; }))
+                return std::nullopt;
+        }
+        return waitForExit();
+    }
+
+    int ProcessCore::terminate(const TerminationPolicy &policy)
+    {
+        if (m_detached || m_pid == -1)
+            return -1;
+
+        sendSignal(policy.signal, policy.processGroup);
+        if (std::optional<int> exitCode = waitUntil(std::chrono::steady_clock::now() + policy.gracePeriod))
+            return *exitCode;
+
+#ifndef _WIN32
+        sendSignal(SIGKILL, policy.processGroup);
+#endif
+        return waitForExit();
+    }
+
+    std::vector<std::string> ProcessCore::buildArgv(const std::string &cmd) const
     {
         std::vector<std::string> out;
         size_t pos = 0, start = 0;
@@ -708,9 +1801,398 @@ namespace cpplib
         return out;
     }
 
-    void Process::onProcessExit()
+    Process::Process()
+        : m_core(std::make_unique<ProcessCore>())
     {
-        m_running = false;
-        waitForExit();
+        m_core->m_in = &in;
+        m_core->m_out = &out;
+        m_core->m_err = &err;
+    }
+
+    Process::~Process() = default;
+
+    Process::Process(Process &&other) noexcept
+    {
+        takeCore(other);
+    }
+
+    Process &Process::operator=(Process &&other) noexcept
+    {
+        if (this != &other)
+        {
+            m_core.reset(); // waits for the current child, like the destructor
+            takeCore(other);
+        }
+        return *this;
+    }
+
+    void Process::takeCore(Process &other)
+    {
+        m_core = std::move(other.m_core);
+        in.rdbuf(other.in.rdbuf());
+        in.clear(other.in.rdstate());
+        out.rdbuf(other.out.rdbuf());
+        out.clear(other.out.rdstate());
+        err.rdbuf(other.err.rdbuf());
+        err.clear(other.err.rdstate());
+        other.in.rdbuf(nullptr);
+        other.out.rdbuf(nullptr);
+        other.err.rdbuf(nullptr);
+        if (m_core)
+        {
+            m_core->m_in = &in;
+            m_core->m_out = &out;
+            m_core->m_err = &err;
+        }
+    }
+
+    void Process::setCommand(const std::filesystem::path &exePath)
+    {
+        m_core->m_exePath = exePath;
+        m_core->m_preparedCommand = nullptr;
+    }
+
+    void Process::setCommand(const std::string &cmd)
+    {
+        auto argv = m_core->buildArgv(cmd);
+        if (!argv.empty())
+        {
+            m_core->m_exePath = argv[0];
+            m_core->m_arguments.assign(argv.begin() + 1, argv.end());
+            m_core->m_preparedCommand = nullptr;
+        }
+    }
+
+    void Process::setCommand(const PreparedCommand &cmd, std::vector<std::string> slotValues)
+    {
+        m_core->m_preparedCommand = &cmd;
+        m_core->m_slotValues = std::move(slotValues);
+    }
+
+    void Process::clearArguments()
+    {
+        m_core->m_arguments.clear();
+    }
+
+    void Process::appendArgument(const std::string &arg)
+    {
+        m_core->m_arguments.push_back(arg);
+    }
+
+    void Process::appendArguments(const std::vector<std::string> &argv)
+    {
+        m_core->m_arguments.insert(m_core->m_arguments.end(), argv.begin(), argv.end());
+    }
+
+    void Process::setWorkingDirectory(const std::string &path)
+    {
+        m_core->m_workingDirectory = path;
+    }
+
+    void Process::setDetached(bool detached)
+    {
+        m_core->m_detached = detached;
+    }
+
+    void Process::setProcessGroup(bool newGroup)
+    {
+        m_core->m_newProcessGroup = newGroup;
+    }
+
+#ifndef _WIN32
+    void Process::setNice(int nice)
+    {
+        m_core->m_nice = nice;
+    }
+
+    void Process::setResourceLimit(int resource, uint64_t soft, uint64_t hard)
+    {
+        for (ResourceLimit &limit : m_core->m_resourceLimits)
+        {
+            if (limit.resource == resource)
+            {
+                limit = {resource, soft, hard};
+                return;
+            }
+        }
+        m_core->m_resourceLimits.push_back({resource, soft, hard});
+    }
+#endif
+
+#ifdef __linux__
+    void Process::setCpuAffinity(const std::vector<int> &cpus)
+    {
+        m_core->m_cpuAffinity = cpus;
+    }
+
+    void Process::setSchedulingPolicy(SchedulingPolicy policy)
+    {
+        m_core->m_schedulingPolicy = policy;
+    }
+
+    void Process::setIoPriority(IoPriorityClass ioClass, int level)
+    {
+        m_core->m_ioPriorityClass = ioClass;
+        m_core->m_ioPriorityLevel = level;
+    }
+
+    void Process::setCgroup(const std::filesystem::path &dir)
+    {
+        m_core->m_cgroup = dir;
+    }
+#endif
+
+    void Process::setSpawnBackend(SpawnBackend backend)
+    {
+        m_core->m_spawnBackend = backend;
+    }
+
+    void Process::setStdinRedirect(const StreamRedirect &redirect)
+    {
+        m_core->m_stdinRedirect = redirect;
+    }
+
+    void Process::setStdoutRedirect(const StreamRedirect &redirect)
+    {
+        m_core->m_stdoutRedirect = redirect;
+    }
+
+    void Process::setStderrRedirect(const StreamRedirect &redirect)
+    {
+        m_core->m_stderrRedirect = redirect;
+    }
+
+    const StreamRedirect &Process::getStdinRedirect() const
+    {
+        return m_core->m_stdinRedirect;
+    }
+
+    const StreamRedirect &Process::getStdoutRedirect() const
+    {
+        return m_core->m_stdoutRedirect;
+    }
+
+    const StreamRedirect &Process::getStderrRedirect() const
+    {
+        return m_core->m_stderrRedirect;
+    }
+
+    void Process::setReactor(ProcessReactor *reactor)
+    {
+        m_core->m_reactor = reactor;
+    }
+
+    void Process::setOutputCallback(std::function<void(const std::string &)> callback)
+    {
+        m_core->m_outputCallback = callback;
+    }
+
+    void Process::setErrorCallback(std::function<void(const std::string &)> callback)
+    {
+        m_core->m_errorCallback = callback;
+    }
+
+    void Process::setOutputChunkCallback(OutputChunkCallback callback)
+    {
+        m_core->m_outputChunkCallback = callback;
+    }
+
+    void Process::setErrorChunkCallback(OutputChunkCallback callback)
+    {
+        m_core->m_errorChunkCallback = callback;
+    }
+
+    void Process::setExitCallback(ExitCallback callback)
+    {
+        m_core->m_exitCallback = callback;
     }
+
+    void Process::setOutputEventCallback(OutputEventCallback callback)
+    {
+        m_core->m_outputEventCallback = callback;
+    }
+
+    void Process::setCollectOutputEvents(bool collect)
+    {
+        m_core->m_collectOutputEvents = collect;
+    }
+
+    const std::vector<OutputEvent> &Process::outputEvents() const
+    {
+        return m_core->m_outputEvents;
+    }
+
+    void Process::setOutputFraming(const RecordFraming &framing)
+    {
+        m_core->m_framing[detail::ProcessCore::StdoutIndex] = framing;
+    }
+
+    void Process::setErrorFraming(const RecordFraming &framing)
+    {
+        m_core->m_framing[detail::ProcessCore::StderrIndex] = framing;
+    }
+
+    void Process::setQueueOutputLines(bool queue)
+    {
+        m_core->m_queueOutputLines = queue;
+    }
+
+    void Process::setOutputTail(size_t maxBytes, size_t maxLines)
+    {
+        m_core->m_tailLimits[detail::ProcessCore::StdoutIndex] = {maxBytes, maxLines};
+    }
+
+    void Process::setErrorTail(size_t maxBytes, size_t maxLines)
+    {
+        m_core->m_tailLimits[detail::ProcessCore::StderrIndex] = {maxBytes, maxLines};
+    }
+
+    const OutputTail &Process::outputTail() const
+    {
+        return m_core->m_tail[detail::ProcessCore::StdoutIndex];
+    }
+
+    const OutputTail &Process::errorTail() const
+    {
+        return m_core->m_tail[detail::ProcessCore::StderrIndex];
+    }
+
+    void Process::setEnvironment(const std::vector<std::string> &env)
+    {
+        m_core->m_environment = env;
+        if (!env.empty())
+            m_core->m_hasCustomEnvironment = true;
+    }
+
+    void Process::pushEnvironmentVariable(const std::string &envVar)
+    {
+        m_core->m_environment.push_back(envVar);
+        m_core->m_hasCustomEnvironment = true;
+    }
+
+#ifndef _WIN32
+    void Process::mapFd(int parentFd, int childFd)
+    {
+        m_core->m_fdMappings.emplace_back(parentFd, childFd);
+    }
+
+    void Process::clearFdMappings()
+    {
+        m_core->m_fdMappings.clear();
+    }
+
+    void Process::setCloseOtherFds(bool close)
+    {
+        m_core->m_closeOtherFds = close;
+    }
+#endif
+
+#ifdef __linux__
+    void Process::clearSharedRings()
+    {
+        m_core->m_sharedRings.clear();
+    }
+#endif
+
+    int Process::getExitCode() const
+    {
+        return m_core->m_exitCode;
+    }
+
+    bool Process::running() const
+    {
+        return m_core->m_running;
+    }
+
+    bool Process::outputAvailable() const
+    {
+        return m_core->m_stdoutBuf && (m_core->m_stdoutBuf->available() || m_core->m_stdoutBuf->hasData());
+    }
+
+    bool Process::errorAvailable() const
+    {
+        return m_core->m_stderrBuf && (m_core->m_stderrBuf->available() || m_core->m_stderrBuf->hasData());
+    }
+
+    int Process::run()
+    {
+        return m_core->run();
+    }
+
+    int Process::run(std::chrono::milliseconds timeout, const TerminationPolicy &policy)
+    {
+        return m_core->run(timeout, policy);
+    }
+
+    int Process::start()
+    {
+        return m_core->start();
+    }
+
+    std::future<int> Process::startAsync()
+    {
+        return m_core->startAsync();
+    }
+
+    CommunicateResult Process::communicate(std::string_view input, const CommunicateOptions &options)
+    {
+        return m_core->communicate(input, options);
+    }
+
+    void Process::closeInput()
+    {
+        m_core->closeInput();
+    }
+
+    int Process::waitForExit()
+    {
+        return m_core->waitForExit();
+    }
+
+    std::optional<int> Process::waitUntil(std::chrono::steady_clock::time_point deadline)
+    {
+        return m_core->waitUntil(deadline);
+    }
+
+    int Process::terminate(const TerminationPolicy &policy)
+    {
+        return m_core->terminate(policy);
+    }
+
+    bool Process::sendSignal(int signal, bool processGroup)
+    {
+        return m_core->sendSignal(signal, processGroup);
+    }
+
+    ProcessStats Process::stats() const
+    {
+        return m_core->stats();
+    }
+
+    bool Process::addCompletionHandler(ProcessCore &core, std::function<void(int)> handler)
+    {
+        return core.addCompletionHandler(std::move(handler));
+    }
+
+    int Process::exitCodeOf(const ProcessCore &core)
+    {
+        return core.m_exitCode;
+    }
+
+    bool Process::lineReady(ProcessCore &core, std::function<void()> waiter)
+    {
+        return core.lineReady(std::move(waiter));
+    }
+
+    std::optional<std::string> Process::popLine(ProcessCore &core)
+    {
+        return core.popLine();
+    }
+
+#ifdef __linux__
+    void Process::shareRing(const SharedRing &ring, const std::string &envName)
+    {
+        m_core->m_sharedRings.emplace_back(envName, ring.fd());
+    }
+#endif
 }; // namespace cpplib
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "ProcessWait.hpp"
+#include "ProcessCore.hpp"
+#include <algorithm>
+#include <memory>
+
+namespace cpplib
+{
+    namespace detail
+    {
+        class CompletionWait
+        {
+        public:
+            /**
+             * Waits until `wanted` of processes have completed, or until deadline.
+             * Without a deadline the stdin of the processes still running is closed first, like waitForExit() does.
+             * Returns the completed processes, in completion order.
+             */
+            static std::vector<ProcessExit> wait(const std::vector<Process *> &processes, size_t wanted,
+                                                 std::optional<std::chrono::steady_clock::time_point> deadline)
+            {
+                // Shared with the handlers, which may still run after this call has returned.
+                struct State
+                {
+                    std::mutex mutex;
+                    std::condition_variable condition;
+                    std::vector<ProcessExit> completed;
+                };
+                auto state = std::make_shared<State>();
+
+                std::vector<std::pair<Process *, uint64_t>> registrations;
+                size_t waitable = 0;
+                for (Process *proc : processes)
+                {
+                    uint64_t id;
+                    bool registered = proc->m_core->addCompletionHandler([state, proc](int exitCode)
+                                                                 {
+                        std::lock_guard<std::mutex> lock(state->mutex);
+                        state->completed.push_back({proc, exitCode});
+                        state->condition.notify_one(); },
+                                                                 &id);
+                    if (registered)
+                    {
+                        registrations.emplace_back(proc, id);
+                        if (!deadline)
+                            proc->m_core->closeInput();
+                    }
+                    else if (proc->m_core->completed())
+                    {
+                        std::lock_guard<std::mutex> lock(state->mutex);
+                        state->completed.push_back({proc, proc->getExitCode()});
+                    }
+                    else
+                    {
+                        continue;
+                    }
+                    ++waitable;
+
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    if (state->completed.size() >= wanted)
+                        break;
+                }
+                wanted = std::min(wanted, waitable);
+
+                std::vector<ProcessExit> result;
+                {
+                    std::unique_lock<std::mutex> lock(state->mutex);
+                    auto done = [&]
+                    { return state->completed.size() >= wanted; };
+                    if (deadline)
+                        state->condition.wait_until(lock, *deadline, done);
+                    else
+                        state->condition.wait(lock, done);
+                    result = state->completed;
+                }
+
+                for (auto &registration : registrations)
+                    registration.first->m_core->removeCompletionHandler(registration.second);
+                return result;
+            }
+        };
+    }
+
+    namespace
+    {
+        std::optional<ProcessExit> first(const std::vector<ProcessExit> &completed)
+        {
+            if (completed.empty())
+                return std::nullopt;
+            return completed.front();
+        }
+    }
+
+    std::optional<ProcessExit> waitAny(const std::vector<Process *> &processes)
+    {
+        return first(detail::CompletionWait::wait(processes, 1, std::nullopt));
+    }
+
+    std::optional<ProcessExit> waitAny(const std::vector<Process *> &processes, std::chrono::milliseconds timeout)
+    {
+        return first(detail::CompletionWait::wait(processes, 1, std::chrono::steady_clock::now() + timeout));
+    }
+
+    std::vector<ProcessExit> waitAll(const std::vector<Process *> &processes)
+    {
+        return detail::CompletionWait::wait(processes, processes.size(), std::nullopt);
+    }
+
+    std::vector<ProcessExit> waitAll(const std::vector<Process *> &processes, std::chrono::milliseconds timeout)
+    {
+        return detail::CompletionWait::wait(processes, processes.size(), std::chrono::steady_clock::now() + timeout);
+    }
+}; // namespace cpplib
@@ -0,0 +1,42 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace cpplib
+{
+    namespace detail
+    {
+        /** Incremental SHA-256 (FIPS 180-4), for the CachedRunner keys. */
+        class Sha256
+        {
+        public:
+            Sha256();
+
+            void update(const void *data, size_t size);
+
+            void update(std::string_view data)
+            {
+                update(data.data(), data.size());
+            }
+
+            /** Hashes a size prefix and then data, so consecutive fields cannot run into each other. */
+            void updateField(std::string_view data);
+
+            /** Finishes the hash, the object must not be updated afterwards. */
+            std::array<uint8_t, 32> digest();
+
+            /** digest() as 64 lowercase hex digits. */
+            std::string hexDigest();
+
+        private:
+            void transform(const uint8_t *block);
+
+            uint32_t m_state[8];
+            uint8_t m_block[64];
+            size_t m_blockSize = 0;
+            uint64_t m_length = 0; // bytes hashed so far
+        };
+    };
+};
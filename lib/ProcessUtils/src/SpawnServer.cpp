@@ -0,0 +1,485 @@
+#include "SpawnServer.hpp"
+#include "ChildSpawn.hpp"
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <mutex>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <cerrno>
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <climits>
+
+extern char **environ;
+#endif
+#endif
+
+namespace cpplib
+{
+#ifdef __linux__
+    namespace
+    {
+        /** Sent before the payload, together with the stdio and mapped fds as SCM_RIGHTS. */
+        struct RequestHeader
+        {
+            uint32_t payloadSize;
+            uint32_t flags;
+            int32_t processGroup;
+            int32_t fdSlot[3];       // index in the received fds of stdin/stdout/stderr, -1 to keep the server's
+            int32_t cgroupSlot;      // index in the received fds of cgroup.procs, -1 for none
+            uint32_t fdMappingCount; // the last received fds, their targets start the payload
+        };
+
+        enum RequestFlags
+        {
+            FLAG_CUSTOM_ENVIRONMENT = 1,
+            FLAG_NEW_SESSION = 2,
+            FLAG_CLOSE_OTHER_FDS = 4,
+        };
+
+        const size_t maxRequestFds = 4 + detail::maxServerFdMappings;
+
+        /** pid -1: no child was created. stage != 0: the child failed before exec and must be reaped. */
+        struct Reply
+        {
+            int32_t pid;
+            int32_t stage;
+            int32_t error;
+        };
+
+        std::mutex serverMutex;
+        int serverSocket = -1;
+        pid_t serverPid = -1;
+
+        bool sendAll(int fd, const char *data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+                if (sent == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                data += sent;
+                size -= sent;
+            }
+            return true;
+        }
+
+        bool recvAll(int fd, char *data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t got = recv(fd, data, size, 0);
+                if (got == 0)
+                    return false;
+                if (got == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                data += got;
+                size -= got;
+            }
+            return true;
+        }
+
+        void appendStrings(std::string &payload, char *const *strings)
+        {
+            for (; strings && *strings; ++strings)
+                payload.append(*strings, std::strlen(*strings) + 1);
+        }
+
+        size_t countStrings(char *const *strings)
+        {
+            size_t count = 0;
+            for (; strings && *strings; ++strings)
+                ++count;
+            return count;
+        }
+
+        void closeInheritedFds(int keep)
+        {
+#ifdef SYS_close_range
+            if ((keep == 3 || syscall(SYS_close_range, 3, keep - 1, 0) == 0) &&
+                syscall(SYS_close_range, keep + 1, ~0U, 0) == 0)
+                return;
+#endif
+            long maxFd = sysconf(_SC_OPEN_MAX);
+            if (maxFd < 0 || maxFd > 65536)
+                maxFd = 65536;
+            for (int fd = 3; fd < maxFd; ++fd)
+                if (fd != keep)
+                    close(fd);
+        }
+
+        /**
+         * Handles one request. Returns false once the parent has closed its end of the socket.
+         */
+        bool serveRequest(int sock)
+        {
+            RequestHeader header;
+            char control[CMSG_SPACE(maxRequestFds * sizeof(int))];
+            iovec iov{&header, sizeof(header)};
+            msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            ssize_t got;
+            do
+                got = recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+            while (got == -1 && errno == EINTR);
+            if (got != sizeof(header))
+                return false;
+
+            std::vector<int> fds;
+            for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                    continue;
+                size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    int fd;
+                    std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                    fds.push_back(fd);
+                }
+            }
+
+            // Payload: argc, envc, the mapping targets, the ChildLimits with its CPUs and resource limits,
+            // then argv, envp, the working directory and the executable (empty for argv[0]) as NUL-terminated strings.
+            std::vector<char> payload(header.payloadSize + 1, '\0');
+            if (!recvAll(sock, payload.data(), header.payloadSize))
+                return false;
+
+            uint32_t counts[2] = {0, 0};
+            std::memcpy(counts, payload.data(), std::min<size_t>(sizeof(counts), header.payloadSize));
+            size_t mappingCount = std::min<size_t>(header.fdMappingCount, fds.size());
+            std::vector<detail::FdMapping> mappings(mappingCount);
+            size_t targetsSize = mappingCount * sizeof(int32_t);
+            for (size_t i = 0; i < mappingCount && sizeof(counts) + targetsSize <= header.payloadSize; ++i)
+            {
+                int32_t target;
+                std::memcpy(&target, payload.data() + sizeof(counts) + i * sizeof(target), sizeof(target));
+                mappings[i] = {fds[fds.size() - mappingCount + i], target};
+            }
+            char *cursor = payload.data() + std::min<size_t>(sizeof(counts) + targetsSize, header.payloadSize);
+            char *end = payload.data() + header.payloadSize;
+
+            detail::ChildLimits limits;
+            if (cursor + sizeof(limits) <= end)
+                std::memcpy(&limits, cursor, sizeof(limits));
+            cursor += std::min<size_t>(sizeof(limits), end - cursor);
+            std::vector<int> cpus(std::min<size_t>(limits.cpuCount, (end - cursor) / sizeof(int32_t)));
+            std::memcpy(cpus.data(), cursor, cpus.size() * sizeof(int32_t));
+            cursor += cpus.size() * sizeof(int32_t);
+            std::vector<ResourceLimit> resourceLimits(std::min<size_t>(limits.resourceLimitCount, (end - cursor) / sizeof(ResourceLimit)));
+            std::memcpy(resourceLimits.data(), cursor, resourceLimits.size() * sizeof(ResourceLimit));
+            cursor += resourceLimits.size() * sizeof(ResourceLimit);
+            limits.cpuCount = static_cast<uint32_t>(cpus.size());
+            limits.resourceLimitCount = static_cast<uint32_t>(resourceLimits.size());
+
+            std::vector<char *> argv, envp;
+            for (uint32_t i = 0; i < counts[0] && cursor < end; ++i, cursor += std::strlen(cursor) + 1)
+                argv.push_back(cursor);
+            for (uint32_t i = 0; i < counts[1] && cursor < end; ++i, cursor += std::strlen(cursor) + 1)
+                envp.push_back(cursor);
+            argv.push_back(nullptr);
+            envp.push_back(nullptr);
+
+            detail::ChildSpec spec;
+            spec.argv = argv.data();
+            spec.envp = envp.data();
+            spec.customEnvironment = header.flags & FLAG_CUSTOM_ENVIRONMENT;
+            // The parent's current environment, used for the PATH lookup and inherited by the child.
+            char **savedEnvironment = environ;
+            if (!spec.customEnvironment)
+                environ = envp.data();
+            spec.workingDirectory = cursor < end && *cursor ? cursor : nullptr;
+            if (cursor < end)
+                cursor += std::strlen(cursor) + 1;
+            spec.executable = cursor < end && *cursor ? cursor : nullptr;
+            spec.newSession = header.flags & FLAG_NEW_SESSION;
+            spec.processGroup = header.processGroup;
+            spec.cloneParent = true;
+            spec.closeOtherFds = header.flags & FLAG_CLOSE_OTHER_FDS;
+            spec.limits = limits;
+            spec.cpus = cpus.data();
+            spec.resourceLimits = resourceLimits.data();
+            if (header.cgroupSlot >= 0 && static_cast<size_t>(header.cgroupSlot) < fds.size())
+                spec.cgroupProcsFd = fds[header.cgroupSlot];
+            int *streams[3] = {&spec.stdinFd, &spec.stdoutFd, &spec.stderrFd};
+            for (int i = 0; i < 3; ++i)
+                if (header.fdSlot[i] >= 0 && static_cast<size_t>(header.fdSlot[i]) < fds.size())
+                    *streams[i] = fds[header.fdSlot[i]];
+
+            Reply reply{-1, 0, 0};
+            // The received fds are numbered by this process, move them out of the way of the targets.
+            std::vector<int> lifted;
+            bool mapped = true;
+            try
+            {
+                detail::liftFdMappings(mappings, {spec.stdinFd, spec.stdoutFd, spec.stderrFd, spec.cgroupProcsFd}, lifted);
+                if (spec.cgroupProcsFd != -1)
+                    spec.cgroupProcsFd = detail::liftAboveTargets(spec.cgroupProcsFd, mappings, lifted);
+                spec.fdMappings = mappings.data();
+                spec.fdMappingCount = mappings.size();
+            }
+            catch (const std::exception &)
+            {
+                mapped = false;
+            }
+
+            if (!mapped)
+            {
+                reply.error = EBADF;
+            }
+            else if (argv.size() > 1)
+            {
+                detail::ChildError err;
+                reply.pid = detail::startChild(spec, SpawnBackend::Vfork, err);
+                reply.stage = err.stage;
+                reply.error = reply.pid == -1 ? errno : err.error;
+            }
+            else
+            {
+                reply.error = EINVAL;
+            }
+            environ = savedEnvironment;
+
+            for (int fd : fds)
+                close(fd);
+            for (int fd : lifted)
+                close(fd);
+            return sendAll(sock, reinterpret_cast<const char *>(&reply), sizeof(reply));
+        }
+
+        [[noreturn]] void serverMain(int sock)
+        {
+            closeInheritedFds(sock);
+
+            // The children need valid fds 0-2 to dup the received streams onto.
+            for (int fd = 0; fd < 3; ++fd)
+            {
+                if (fcntl(fd, F_GETFD) == -1)
+                {
+                    int null = open("/dev/null", O_RDWR);
+                    if (null != -1 && null != fd)
+                    {
+                        dup2(null, fd);
+                        close(null);
+                    }
+                }
+            }
+
+            // Keeps terminal signals (Ctrl-C) for the parent's process group,
+            // the children join the parent's group again before exec.
+            setpgid(0, 0);
+
+            while (serveRequest(sock))
+                ;
+            _exit(0);
+        }
+    }
+
+    void SpawnServer::start()
+    {
+        std::lock_guard<std::mutex> lock(serverMutex);
+        if (serverSocket != -1)
+            return;
+
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+            throw std::runtime_error(std::string("SpawnServer: socketpair() failed: ") + std::strerror(errno));
+
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            int forkErrno = errno;
+            close(fds[0]);
+            close(fds[1]);
+            throw std::runtime_error(std::string("SpawnServer: fork() failed: ") + std::strerror(forkErrno));
+        }
+        if (pid == 0)
+        {
+            close(fds[0]);
+            serverMain(fds[1]);
+        }
+
+        close(fds[1]);
+        serverSocket = fds[0];
+        serverPid = pid;
+    }
+
+    void SpawnServer::stop()
+    {
+        std::lock_guard<std::mutex> lock(serverMutex);
+        if (serverSocket == -1)
+            return;
+
+        // The server exits when it reads EOF.
+        close(serverSocket);
+        serverSocket = -1;
+        int status;
+        while (waitpid(serverPid, &status, 0) == -1 && errno == EINTR)
+            ;
+        serverPid = -1;
+    }
+
+    bool SpawnServer::running()
+    {
+        std::lock_guard<std::mutex> lock(serverMutex);
+        return serverSocket != -1;
+    }
+
+    pid_t detail::spawnThroughServer(const ChildSpec &spec)
+    {
+        RequestHeader header{};
+        header.flags = (spec.customEnvironment ? FLAG_CUSTOM_ENVIRONMENT : 0) |
+                       (spec.newSession ? FLAG_NEW_SESSION : 0) |
+                       (spec.closeOtherFds ? FLAG_CLOSE_OTHER_FDS : 0);
+        header.processGroup = spec.newSession ? -1 : (spec.processGroup != -1 ? spec.processGroup : getpgrp());
+
+        // Streams kept by the caller are passed too, the server's may have been redirected since.
+        std::vector<int> fds;
+        int streams[3] = {spec.stdinFd, spec.stdoutFd, spec.stderrFd};
+        for (int i = 0; i < 3; ++i)
+        {
+            int fd = streams[i] != -1 ? streams[i] : i;
+            header.fdSlot[i] = -1;
+            if (fcntl(fd, F_GETFD) != -1)
+            {
+                header.fdSlot[i] = static_cast<int32_t>(fds.size());
+                fds.push_back(fd);
+            }
+        }
+        header.cgroupSlot = -1;
+        if (spec.cgroupProcsFd != -1)
+        {
+            header.cgroupSlot = static_cast<int32_t>(fds.size());
+            fds.push_back(spec.cgroupProcsFd);
+        }
+        header.fdMappingCount = static_cast<uint32_t>(spec.fdMappingCount);
+        for (size_t i = 0; i < spec.fdMappingCount; ++i)
+            fds.push_back(spec.fdMappings[i].from);
+
+        char *const *envp = spec.envp ? spec.envp : environ;
+        uint32_t counts[2] = {static_cast<uint32_t>(countStrings(spec.argv)), static_cast<uint32_t>(countStrings(envp))};
+        std::string payload(reinterpret_cast<const char *>(counts), sizeof(counts));
+        for (size_t i = 0; i < spec.fdMappingCount; ++i)
+        {
+            int32_t target = spec.fdMappings[i].to;
+            payload.append(reinterpret_cast<const char *>(&target), sizeof(target));
+        }
+        payload.append(reinterpret_cast<const char *>(&spec.limits), sizeof(spec.limits));
+        for (uint32_t i = 0; i < spec.limits.cpuCount; ++i)
+        {
+            int32_t cpu = spec.cpus[i];
+            payload.append(reinterpret_cast<const char *>(&cpu), sizeof(cpu));
+        }
+        if (spec.limits.resourceLimitCount)
+            payload.append(reinterpret_cast<const char *>(spec.resourceLimits), spec.limits.resourceLimitCount * sizeof(ResourceLimit));
+        appendStrings(payload, spec.argv);
+        appendStrings(payload, envp);
+        if (spec.workingDirectory)
+        {
+            payload.append(spec.workingDirectory);
+        }
+        else
+        {
+            char cwd[PATH_MAX];
+            if (getcwd(cwd, sizeof(cwd)))
+                payload.append(cwd);
+        }
+        payload.push_back('\0');
+        if (spec.executable)
+            payload.append(spec.executable);
+        payload.push_back('\0');
+        header.payloadSize = static_cast<uint32_t>(payload.size());
+
+        std::lock_guard<std::mutex> lock(serverMutex);
+        if (serverSocket == -1)
+            throw std::runtime_error("Process::start(): the spawn server is not running");
+
+        char control[CMSG_SPACE(maxRequestFds * sizeof(int))] = {};
+        iovec iov{&header, sizeof(header)};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (!fds.empty())
+        {
+            msg.msg_control = control;
+            msg.msg_controllen = CMSG_SPACE(fds.size() * sizeof(int));
+            cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(fds.size() * sizeof(int));
+            std::memcpy(CMSG_DATA(cmsg), fds.data(), fds.size() * sizeof(int));
+        }
+
+        ssize_t sent;
+        do
+            sent = sendmsg(serverSocket, &msg, MSG_NOSIGNAL);
+        while (sent == -1 && errno == EINTR);
+
+        Reply reply{};
+        if (sent == -1 ||
+            !sendAll(serverSocket, reinterpret_cast<const char *>(&header) + sent, sizeof(header) - sent) ||
+            !sendAll(serverSocket, payload.data(), payload.size()) ||
+            !recvAll(serverSocket, reinterpret_cast<char *>(&reply), sizeof(reply)))
+        {
+            close(serverSocket);
+            serverSocket = -1;
+            int status;
+            while (waitpid(serverPid, &status, 0) == -1 && errno == EINTR)
+                ;
+            serverPid = -1;
+            throw std::runtime_error("Process::start(): the spawn server exited");
+        }
+
+        if (reply.pid == -1)
+            throw std::runtime_error(std::string("Process::start(): spawn server failed: ") + std::strerror(reply.error));
+        if (reply.stage != 0)
+        {
+            // The child is ours (CLONE_PARENT), reap it.
+            int status;
+            while (waitpid(reply.pid, &status, 0) == -1 && errno == EINTR)
+                ;
+            throw std::runtime_error(describeChildError(ChildError{reply.stage, reply.error}));
+        }
+        return reply.pid;
+    }
+#else
+    void SpawnServer::start()
+    {
+        throw std::runtime_error("SpawnServer is only supported on Linux");
+    }
+
+    void SpawnServer::stop()
+    {
+    }
+
+    bool SpawnServer::running()
+    {
+        return false;
+    }
+
+#ifndef _WIN32
+    pid_t detail::spawnThroughServer(const ChildSpec &)
+    {
+        throw std::runtime_error("Process::start(): the spawn server is only supported on Linux");
+    }
+#endif
+#endif
+}; // namespace cpplib
@@ -0,0 +1,45 @@
+#pragma once
+// Shared by the tests: a CHECK macro that counts failures instead of aborting, and job factories.
+
+#include <Rbel12b-cpplib/ProcessUtils/ProcessPool.hpp>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define CHECK(condition)                                                                         \
+    do                                                                                           \
+    {                                                                                            \
+        if (!(condition))                                                                        \
+        {                                                                                        \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n";      \
+            ++cpplib::test::failures;                                                            \
+        }                                                                                        \
+    } while (0)
+
+namespace cpplib
+{
+    namespace test
+    {
+        inline int failures = 0;
+
+        /** A command that never exists, so start() throws. */
+        inline const char *missingCommand = "/nonexistent/cpplib-test-command";
+
+        inline ProcessJob makeJob(const std::filesystem::path &command, std::vector<std::string> arguments = {})
+        {
+            ProcessJob job;
+            job.command = command;
+            job.arguments = std::move(arguments);
+            return job;
+        }
+
+        /** The exit code of a test executable, after reporting the failed checks. */
+        inline int result()
+        {
+            if (failures)
+                std::cerr << failures << " check(s) failed" << std::endl;
+            return failures ? 1 : 0;
+        }
+    }
+};
@@ -0,0 +1,140 @@
+// Tests for Process::setCgroup() combined with mapped fds, run by ctest (Linux).
+// Exits with 77 (skipped) without a writable cgroup v2 hierarchy.
+
+#include "TestSupport.hpp"
+#include <Rbel12b-cpplib/ProcessUtils/ProcessUtils.hpp>
+#include <Rbel12b-cpplib/ProcessUtils/SpawnServer.hpp>
+#include <fstream>
+#include <sstream>
+
+#include <unistd.h>
+
+using namespace cpplib;
+using namespace cpplib::test;
+
+namespace
+{
+    /** Where the cgroup v2 hierarchy is mounted, empty if it is not. */
+    std::filesystem::path cgroup2Mount()
+    {
+        // "<id> <parent> <dev> <root> <mount point> <options> ... - <type> <source> <options>"
+        std::ifstream mounts("/proc/self/mountinfo");
+        std::string line;
+        while (std::getline(mounts, line))
+        {
+            std::istringstream fields(line);
+            std::string field, mountPoint;
+            for (int i = 0; i < 5 && fields >> field; ++i)
+                mountPoint = field;
+            while (fields >> field && field != "-")
+                ;
+            if (fields >> field && field == "cgroup2")
+                return mountPoint;
+        }
+        return {};
+    }
+
+    /** This process's cgroup v2 path, from the "0::" line. */
+    std::string ownCgroup()
+    {
+        std::ifstream cgroups("/proc/self/cgroup");
+        std::string line;
+        while (std::getline(cgroups, line))
+        {
+            if (line.rfind("0::", 0) == 0)
+                return line.substr(3);
+        }
+        return {};
+    }
+
+    std::string readAll(int fd)
+    {
+        std::string data;
+        char buffer[4096];
+        ssize_t got;
+        while ((got = read(fd, buffer, sizeof(buffer))) > 0)
+            data.append(buffer, got);
+        return data;
+    }
+
+    void testCgroupWithMappedFds(const std::filesystem::path &cgroup, const std::string &cgroupPath, SpawnBackend backend)
+    {
+        int results[2];
+        if (pipe(results) == -1)
+        {
+            CHECK(!"pipe() failed");
+            return;
+        }
+
+        // Targets covering the numbers start() opens its own fds at, the cgroup.procs one among them.
+        int lowest = dup(0);
+        close(lowest);
+        const int targets = 32;
+        std::string expected;
+        Process proc;
+        for (int fd = lowest; fd < lowest + targets; ++fd)
+        {
+            proc.mapFd(results[1], fd);
+            expected += std::to_string(fd) + "\n";
+        }
+        proc.setCloseOtherFds(true);
+        proc.setCgroup(cgroup);
+        proc.setSpawnBackend(backend);
+        proc.setCommand(std::filesystem::path("/bin/sh"));
+        proc.appendArguments({"-c", "for fd in $(seq " + std::to_string(lowest) + " " + std::to_string(lowest + targets - 1) +
+                                        "); do echo $fd > /proc/self/fd/$fd; done; grep '^0::' /proc/self/cgroup"});
+
+        CommunicateResult result;
+        try
+        {
+            result = proc.communicate();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "start() failed: " << e.what() << std::endl;
+            CHECK(!"start() failed");
+        }
+        close(results[1]);
+        std::string written = readAll(results[0]);
+        close(results[0]);
+
+        CHECK(result.exitCode == 0);
+        CHECK(result.output == "0::" + cgroupPath + "\n");
+        // Nothing but the child's own writes, in particular not the "0" meant for cgroup.procs.
+        CHECK(written == expected);
+    }
+}
+
+int main()
+{
+    // Forked while this process is still small, like an application would.
+    bool server = true;
+    try
+    {
+        SpawnServer::start();
+    }
+    catch (const std::exception &)
+    {
+        server = false;
+    }
+
+    std::filesystem::path mount = cgroup2Mount();
+    std::string own = ownCgroup();
+    std::string cgroupPath = (own == "/" ? "" : own) + "/cpplib-test-" + std::to_string(getpid());
+    std::filesystem::path cgroup = mount.string() + cgroupPath;
+    std::error_code ec;
+    if (mount.empty() || own.empty() || !std::filesystem::create_directory(cgroup, ec))
+    {
+        std::cerr << "skipped: no writable cgroup v2 hierarchy" << std::endl;
+        return 77;
+    }
+
+    for (SpawnBackend backend : {SpawnBackend::Fork, SpawnBackend::Vfork, SpawnBackend::PosixSpawn, SpawnBackend::Server})
+    {
+        if (backend != SpawnBackend::Server || server)
+            testCgroupWithMappedFds(cgroup, cgroupPath, backend);
+    }
+
+    std::filesystem::remove(cgroup, ec);
+    return result();
+}
@@ -0,0 +1,79 @@
+// Tests for ProcessGraph, run by ctest. Exits with 1 after printing the failed checks.
+
+#include "TestSupport.hpp"
+#include <Rbel12b-cpplib/ProcessUtils/ProcessGraph.hpp>
+#include <algorithm>
+#include <vector>
+
+using namespace cpplib;
+using namespace cpplib::test;
+
+namespace
+{
+    void testDependencies()
+    {
+        ProcessGraph graph(2);
+        ProcessGraph::NodeId first = graph.addNode(makeJob("/bin/sh", {"-c", "exit 0"}));
+        ProcessGraph::NodeId second = graph.addNode(makeJob("/bin/sh", {"-c", "exit 0"}), {first});
+        ProcessGraph::NodeId failing = graph.addNode(makeJob("/bin/sh", {"-c", "exit 3"}), {first});
+        ProcessGraph::NodeId missing = graph.addNode(makeJob(missingCommand));
+        ProcessGraph::NodeId skipped = graph.addNode(makeJob("/bin/sh", {"-c", "exit 0"}), {second, failing});
+        ProcessGraph::NodeId skippedToo = graph.addNode(makeJob("/bin/sh", {"-c", "exit 0"}), {missing});
+
+        std::vector<ProcessGraph::NodeId> order;
+        graph.start();
+        while (auto result = graph.next())
+        {
+            order.push_back(result->id);
+            if (result->id == failing)
+                CHECK(result->exitCode == 3 && result->error.empty());
+            if (result->id == missing)
+                CHECK(result->exitCode == -1 && !result->error.empty());
+        }
+        CHECK(order.size() == graph.size());
+        CHECK(graph.state(first) == ProcessGraph::NodeState::Succeeded);
+        CHECK(graph.state(second) == ProcessGraph::NodeState::Succeeded);
+        CHECK(graph.state(failing) == ProcessGraph::NodeState::Failed);
+        CHECK(graph.state(missing) == ProcessGraph::NodeState::Failed);
+        CHECK(graph.state(skipped) == ProcessGraph::NodeState::Skipped);
+        CHECK(graph.state(skippedToo) == ProcessGraph::NodeState::Skipped);
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            if (order[i] == second)
+                CHECK(std::find(order.begin(), order.begin() + i, first) != order.begin() + i);
+        }
+    }
+
+    void testFailedStartsBehindRunningNode()
+    {
+        // Made ready together once the first node succeeds, each failed start used to start the
+        // next node itself from the reactor thread, one stack frame deeper.
+        const size_t failing = 20000;
+        ProcessGraph graph(1);
+        ProcessGraph::NodeId first = graph.addNode(makeJob("/bin/sleep", {"0.2"}));
+        for (size_t i = 0; i < failing; ++i)
+            graph.addNode(makeJob(missingCommand), {first});
+
+        graph.start();
+        size_t failed = 0;
+        while (auto result = graph.next())
+        {
+            if (result->id == first)
+            {
+                CHECK(result->state == ProcessGraph::NodeState::Succeeded);
+                continue;
+            }
+            CHECK(result->state == ProcessGraph::NodeState::Failed && !result->error.empty());
+            ++failed;
+        }
+        CHECK(failed == failing);
+        CHECK(graph.running() == 0);
+    }
+}
+
+int main()
+{
+    testDependencies();
+    testFailedStartsBehindRunningNode();
+    return result();
+}
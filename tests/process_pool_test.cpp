@@ -0,0 +1,73 @@
+// Tests for ProcessPool, run by ctest. Exits with 1 after printing the failed checks.
+
+#include "TestSupport.hpp"
+#include <Rbel12b-cpplib/ProcessUtils/ProcessPool.hpp>
+#include <set>
+
+using namespace cpplib;
+using namespace cpplib::test;
+
+namespace
+{
+    void testResults()
+    {
+        ProcessPool pool(2);
+        ProcessPool::JobId succeeding = pool.submit(makeJob("/bin/sh", {"-c", "exit 0"}));
+        ProcessPool::JobId exiting = pool.submit(makeJob("/bin/sh", {"-c", "exit 3"}));
+        ProcessPool::JobId missing = pool.submit(makeJob(missingCommand));
+
+        size_t count = 0;
+        while (auto result = pool.next())
+        {
+            ++count;
+            if (result->id == succeeding)
+                CHECK(result->exitCode == 0 && result->error.empty());
+            else if (result->id == exiting)
+                CHECK(result->exitCode == 3 && result->error.empty());
+            else if (result->id == missing)
+                CHECK(result->exitCode == -1 && !result->error.empty());
+            else
+                CHECK(!"unknown job id");
+        }
+        CHECK(count == 3);
+    }
+
+    void testFailedStartsBehindRunningJob()
+    {
+        // Started one after another from the finishing job's exit callback, each failed start
+        // used to start the next job itself, one stack frame deeper (overflowed at ~10000 jobs).
+        const size_t failing = 20000;
+        ProcessPool pool(1);
+        pool.submit(makeJob("/bin/sleep", {"0.2"}));
+        std::set<ProcessPool::JobId> ids;
+        for (size_t i = 0; i < failing; ++i)
+            ids.insert(pool.submit(makeJob(missingCommand)));
+        CHECK(pool.queued() == failing);
+
+        size_t failed = 0;
+        size_t succeeded = 0;
+        while (auto result = pool.next())
+        {
+            if (ids.count(result->id))
+            {
+                CHECK(result->exitCode == -1 && !result->error.empty());
+                ++failed;
+            }
+            else
+            {
+                CHECK(result->exitCode == 0);
+                ++succeeded;
+            }
+        }
+        CHECK(failed == failing);
+        CHECK(succeeded == 1);
+        CHECK(pool.running() == 0);
+    }
+}
+
+int main()
+{
+    testResults();
+    testFailedStartsBehindRunningJob();
+    return result();
+}
@@ -0,0 +1,67 @@
+// Tests for waitAny() and waitAll(), run by ctest. Exits with 1 after printing the failed checks.
+
+#include "TestSupport.hpp"
+#include <Rbel12b-cpplib/ProcessUtils/ProcessWait.hpp>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+using namespace cpplib;
+using namespace cpplib::test;
+
+namespace
+{
+    std::unique_ptr<Process> startCat()
+    {
+        auto proc = std::make_unique<Process>();
+        proc->setCommand(std::filesystem::path("/bin/cat"));
+        proc->setOutputTail(64);
+        proc->start();
+        return proc;
+    }
+
+    void testWaitAllClosesInput()
+    {
+        // cat only exits at EOF on its stdin, which used to be left open.
+        auto first = startCat();
+        auto second = startCat();
+        first->in << "first" << std::flush;
+
+        std::vector<ProcessExit> completed = waitAll({first.get(), second.get()});
+        CHECK(completed.size() == 2);
+        for (const ProcessExit &exit : completed)
+            CHECK(exit.exitCode == 0);
+        first->waitForExit();
+        second->waitForExit();
+        CHECK(first->outputTail().str() == "first");
+        CHECK(second->outputTail().empty());
+    }
+
+    void testWaitAnyClosesInput()
+    {
+        auto proc = startCat();
+        std::optional<ProcessExit> completed = waitAny({proc.get()});
+        CHECK(completed && completed->process == proc.get() && completed->exitCode == 0);
+        proc->waitForExit();
+    }
+
+    void testTimedWaitLeavesInputOpen()
+    {
+        auto proc = startCat();
+        CHECK(!waitAny({proc.get()}, std::chrono::milliseconds(100)));
+        CHECK(waitAll({proc.get()}, std::chrono::milliseconds(100)).empty());
+
+        proc->closeInput();
+        std::optional<ProcessExit> completed = waitAny({proc.get()}, std::chrono::seconds(10));
+        CHECK(completed && completed->exitCode == 0);
+        proc->waitForExit();
+    }
+}
+
+int main()
+{
+    testWaitAllClosesInput();
+    testWaitAnyClosesInput();
+    testTimedWaitLeavesInputOpen();
+    return result();
+}